@@ -34,6 +34,7 @@
 #include "libfolia/folia_subclasses.h"
 #include "libfolia/folia_document.h"
 #include "libfolia/folia_engine.h"
+#include "libfolia/folia_index.h"
 #include "libfolia/folia_provenance.h"
 using TiCC::operator<<;
 
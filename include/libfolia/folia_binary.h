@@ -0,0 +1,161 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of libfolia
+
+  libfolia is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  libfolia is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#ifndef FOLIA_BINARY_H
+#define FOLIA_BINARY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <stdexcept>
+#include "libxml/tree.h"
+#include "libfolia/folia_impl.h"
+
+namespace folia {
+  class Document;
+
+  namespace binary {
+    /// the binary snapshot format.
+    /*!
+      A snapshot starts with a header:
+      - 8 bytes magic "FoLiAbin"
+      - uint32 format version
+      - uint32 byte order mark
+      - uint32 number of strings, uint64 size of the string table
+      - the string table: per string an uint32 length followed by the bytes
+      - uint64 size of the node stream, followed by the node stream
+      - (since version 2) the id table: an uint32 count, followed by
+        (uint32 id, uint64 offset) pairs, sorted on id. The offset is the
+        position of the element record in the node stream.
+
+      The node stream is a pre-order walk over the XML tree. Every record
+      starts with a one byte record type. Strings are stored as indices in the
+      string table, where 0 means 'no value'.
+      An ELEMENT_REC holds the name, the namespace, the namespace definitions,
+      the attributes and the uint64 size of its children block, which ends
+      with an END_REC.
+    */
+    const uint32_t FORMAT_VERSION = 2;
+
+    enum RecordType : uint8_t {
+      END_REC = 0,
+      ELEMENT_REC = 1,
+      TEXT_REC = 2,
+      CDATA_REC = 3,
+      COMMENT_REC = 4,
+      PI_REC = 5
+    };
+
+    class BinaryFormatError: public std::runtime_error {
+    public:
+      explicit BinaryFormatError( const std::string& s ):
+	std::runtime_error( "binary snapshot: " + s ){};
+    };
+
+    class Cursor {
+      /// a bounds checked read position in a snapshot buffer
+    public:
+      Cursor( const char *, size_t );
+      void need( size_t ) const;
+      uint8_t u8();
+      uint32_t u32();
+      uint64_t u64();
+      void skip( uint64_t );
+      const char *pos;
+      const char *end;
+    };
+
+    struct Deferral {
+      /// registers which subtrees are skipped while decoding
+      std::set<std::string> tags; ///< the tags of the elements to defer
+      std::map<const xmlNode*,std::pair<uint64_t,uint64_t>> pending; ///<
+      ///< the skipped children blocks, as (offset,size) in the node stream
+    };
+
+    class Snapshot {
+      /// a decoded view on the header and string table of a snapshot
+    public:
+      Snapshot( const char *, size_t );
+      std::string str( uint32_t ) const;
+      xmlChar *xml_str( uint32_t ) const;
+      xmlDoc *to_xmlDoc( Deferral * = 0 ) const;
+      void decode_children( Cursor&, xmlDoc *, xmlNode *,
+			    Deferral * = 0 ) const;
+      void decode_element( Cursor&, xmlDoc *, xmlNode *, Deferral * ) const;
+      bool find_id( const std::string&, uint64_t& ) const;
+      Cursor nodes; ///< the node stream
+    private:
+      std::vector<const char*> strings;
+      std::vector<uint32_t> lengths;
+      const char *id_table;
+      uint32_t id_count;
+    };
+
+    class MappedSource {
+      /// a read-only memory mapped snapshot, that is parsed on demand
+    public:
+      MappedSource( const std::string&, const std::set<std::string>& );
+      ~MappedSource();
+      xmlDoc *skeleton();
+      bool defer( AbstractElement *, const xmlNode * );
+      void expand( AbstractElement *, uint64_t, uint64_t );
+      void release( uint64_t );
+      bool expand_for( const std::string& );
+    private:
+      MappedSource( const MappedSource& ) = delete;
+      MappedSource& operator=( const MappedSource& ) = delete;
+      void *map;
+      size_t map_size;
+      Snapshot *snap;
+      Deferral deferral;
+      std::vector<std::pair<std::string,std::string>> root_ns;
+      std::map<uint64_t,std::pair<uint64_t,AbstractElement*>> open_ranges; ///<
+      ///< the not yet expanded subtrees, by start offset
+    };
+
+    class BinarySubtree: public DeferredSubtree {
+      /// the children of an element, stored in a MappedSource
+    public:
+      BinarySubtree( MappedSource *, uint64_t, uint64_t );
+      ~BinarySubtree() override;
+      void expand( AbstractElement * ) override;
+    private:
+      MappedSource *source;
+      uint64_t start;
+      uint64_t size;
+    };
+
+    std::string encode( const xmlDoc * );
+    void put_u32( std::string&, uint32_t );
+    void put_u64( std::string&, uint64_t );
+
+  } // namespace binary
+
+} // namespace folia
+
+#endif // FOLIA_BINARY_H
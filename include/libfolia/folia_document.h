@@ -34,6 +34,8 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <atomic>
+#include <mutex>
 #include "unicode/unistr.h"
 #include "unicode/regex.h"
 #include "libxml/tree.h"
@@ -41,6 +43,7 @@
 #include "ticcutils/enum_flags.h"
 #include "ticcutils/LogStream.h"
 #include "libfolia/folia.h"
+#include "libfolia/folia_metrics.h"
 
 using namespace icu;
 
@@ -82,10 +85,23 @@ namespace folia {
   class Paragraph;
   class processor;
   class Provenance;
+  class AbstractElement;
+  namespace binary {
+    class MappedSource;
+  }
 
+  /// a FoLiA Document
+  /*!
+    Concurrency: all const query functions (select(), text(), index(),
+    xmlstring(), save() etc.) may be used from several threads at once on
+    one Document, as long as no thread modifies it at the same time.
+    Documents in LAZY mode, or memory mapped Documents, expand subtrees
+    while reading. Call expand_all() before sharing those.
+  */
   class Document {
     friend std::ostream& operator<<( std::ostream& os, const Document *d );
     friend class Engine;
+    friend class binary::MappedSource;
 
   public:
     /// enum Mode determines runtime characteristic of the document
@@ -100,7 +116,8 @@ namespace folia {
       STRIP=8,         //!< on output, strip
       CANONICAL=16,    //!< sort ouput in a reproducable way.
       AUTODECLARE=32,  //!< Automagicly add missing Annotation Declarations
-      EXPLICIT=64      //!< add all set information
+      EXPLICIT=64,     //!< add all set information
+      LAZY=128         //!< parse the children of lazy_types() on demand
     };
     enum class DEBUG_FLAGS {
       NODEBUG=0,            //!< nodebug.
@@ -130,11 +147,66 @@ namespace folia {
       return save( os, "", canonical );
     }
     bool save( const std::string&, const std::string&, bool = false ) const ;
+    std::string save_prologue( std::ostream&, const std::string& = "" ) const;
     bool save( const std::string& s, bool canonical = false ) const {
       /// save a Document to a file without using a namespace name
       return save( s, "", canonical );
     }
     std::string xmlstring( bool = false ) const;
+    bool save_binary( std::ostream& ) const;
+    bool save_binary( const std::string& ) const;
+    bool load_binary( std::istream& );
+    bool load_binary( const std::string& );
+    bool load_binary( const char *, size_t );
+    bool map_binary( const std::string& );
+    void expand_all();
+    bool is_mapped() const {
+      /// is this Document backed by a memory mapped snapshot?
+      /// (see map_binary(). The Document is still mutable)
+      return _mapped != 0;
+    }
+    void set_lazy_types( const std::set<ElementType>& types ){
+      /// set the types of the elements which children are parsed on demand,
+      /// or on a worker thread when parse_threads() > 1
+      _lazy_types = types;
+    }
+    const std::set<ElementType>& lazy_types() const {
+      return _lazy_types;
+    }
+    void set_parse_threads( unsigned int );
+    unsigned int parse_threads() const {
+      /// return the number of threads used to parse the lazy_types() subtrees
+      return _parse_threads;
+    }
+    void set_concurrent_updates( bool b ){
+      /// when true, the registries of the Document (id index, declarations,
+      /// references etc.) are locked on every use, so several threads may
+      /// add nodes to different subtrees at the same time
+      _concurrent_updates = b;
+    }
+    bool concurrent_updates() const {
+      return _concurrent_updates;
+    }
+    void freeze_declarations( bool b ){
+      /// when true, adding a new annotation declaration throws a
+      /// DeclarationError. The Engine sets this once the header is output
+      _declarations_frozen = b;
+    }
+    bool declarations_frozen() const {
+      return _declarations_frozen;
+    }
+    void enable_metrics( bool = true );
+    Metrics *metrics() const {
+      /// return the time spent in the phases of parsing and output, or 0
+      /// when not enabled
+      return _metrics;
+    }
+    bool defer_subtree( AbstractElement *, const xmlNode * );
+    bool postpone_checks( const AbstractElement * );
+    void forget_postponed( const FoliaElement *el ){
+      /// el is destroyed, so don't run any postponed checks on it
+      _postponed.erase( el );
+    }
     void set_dbg_stream( TiCC::LogStream * );
     FoliaElement* doc() const {
       /// return a pointer to the internal FoLiA tree
@@ -249,25 +321,9 @@ namespace folia {
       /// return a pointer to the internal xmlDoc. handle with care.
       return _xmldoc;
     };
-    xmlNs *foliaNs() const {
-      /// return a pointer to the output namespace structure
-      return _foliaNsOut;
-    };
-    void keepForDeletion( FoliaElement *p ) {
-      /// add FoliaElement \e p to the delSet
-      /*!
-	\param p the FoliaElement to keep for later annihilation
-	the delSet is kept until the destruction of the Document
-       */
-      delSet.insert( p );
-    };
-    void addExternal( External *p ) {
-      /// add a node to the _externals list
-      /*!
-	\param p The node to add
-      */
-      _externals.push_back( p );
-    };
+    xmlNs *foliaNs() const;
+    void keepForDeletion( FoliaElement * );
+    void addExternal( External * );
     void resolveExternals();
     DEBUG_FLAGS debug; //!< the debug level. 0 means NO debugging.
 
@@ -285,6 +341,7 @@ namespace folia {
     bool autodeclare() const;
     /// is the EXPLICITE mode set?
     bool has_explicit() const;
+    bool lazy() const;
     bool set_permissive( bool ) const; // defined const, but the mode is mutable!
     bool set_checktext( bool ) const; // defined const, but the mode is mutable!
     bool set_fixtext( bool ) const; // defined const, but the mode is mutable!
@@ -292,6 +349,7 @@ namespace folia {
     bool set_canonical( bool ) const; // defined const, but the mode is mutable!
     bool set_autodeclare( bool ) const; // defined const, but the mode is mutable!
     bool set_explicit( bool ) const; // defined const, but the mode is mutable!
+    bool set_lazy( bool ) const; // defined const, but the mode is mutable!
     /// this class holds annotation declaration information
     class annotation_info {
       friend std::ostream& operator<<( std::ostream& os,
@@ -346,25 +404,9 @@ namespace folia {
 	return it->second;
       }
     }
-    void cache_textcontent( TextContent *tc ){
-      /// add a TextContent to the validation buffer
-      /*!
-	\param tc the TextContent to add to the buffer
-	on a call to validate_offsets() this buffer is used to validate
-	all offsets.
-      */
-      t_offset_validation_buffer.push_back( tc );
-    }
-    void cache_phoncontent( PhonContent *pc ){
-      /// add a PhonContent to the validation buffer
-      /*!
-	\param pc the PhonContent to add
-	on a call to validate_offsets() this buffer is used to validate
-	all offsets.
-      */
-      p_offset_validation_buffer.push_back( pc );
-    }
-    bool validate_offsets() const;
+    void cache_textcontent( TextContent * );
+    void cache_phoncontent( PhonContent * );
+    bool validate_offsets( size_t = 0, size_t = 0 ) const;
     int compare_to_build_version() const;
     const std::string& version() const {
       /// return the version string
@@ -389,18 +431,16 @@ namespace folia {
       /// set/unset the incremental_parse flag
       _incremental_parse = b;
     };
+    bool trusted_input() const {
+      /// are we restoring an already validated Document? (from a snapshot)
+      return _trusted_input;
+    }
     bool is_incremental() const {
       /// return the value of the incremental_parse flag
       return _incremental_parse;
     };
-    void set_preserve_spaces( bool b ) {
-      /// set/unset the preserve_spaces flag
-      _preserve_spaces = b;
-    };
-    bool preserve_spaces() const {
-      /// return the value of the preserve_spaces flag
-      return _preserve_spaces;
-    }
+    void set_preserve_spaces( bool ) const;
+    bool preserve_spaces() const;
     int get_warn_count( ) const {
       /// return the number of warnings
       return _warn_count;
@@ -409,18 +449,20 @@ namespace folia {
       /// reset the number of warnings to 0
       _warn_count = 0;
     }
-    void increment_warn_count() const {
-      /// increment the warning count
-      // NOTE: function is defined const, but the _warn_count is mutable
-      ++_warn_count;
-    }
-    void add_textclass( const std::string& tc ){
-      _textclasses.insert( tc );
-    }
-    const std::set<std::string>& textclasses() const {
-      return _textclasses;
-    }
+    void increment_warn_count() const;
+    void add_textclass( const std::string& );
+    const std::set<std::string>& textclasses() const;
   private:
+    class XmlSubtree;
+    class ParseJob;
+    class TrustedParse;
+    static thread_local ParseJob *_current_job; ///< the job this thread works on
+    ParseJob *worker_job() const;
+    std::unique_lock<std::recursive_mutex> shared_guard() const;
+    void run_parse_jobs();
+    void merge_parse_job( ParseJob& );
+    void expanded( AbstractElement *, size_t, size_t );
+    void release_postponed( AbstractElement * );
     void test_temporary_text_exception( const std::string& ) const;
     void adjustTextMode();
     std::map<AnnotationType,std::map<std::string,annotation_info> > _annotationdefaults;   ///< stores all declared annotations per AnnotationType
@@ -457,13 +499,22 @@ namespace folia {
     void parse_provenance( const xmlNode * );
     void parse_submeta( const xmlNode * );
     void parse_styles();
-    void add_annotations( xmlNode * ) const;
+    void add_annotations( xmlNode *, bool ) const;
     void add_provenance( xmlNode * ) const;
     void add_metadata( xmlNode * ) const;
     void add_submetadata( xmlNode *) const;
     void add_styles( xmlDoc* ) const;
     void append_processor( xmlNode *, const processor * ) const;
-    xmlDoc *to_xmlDoc( const std::string& ="" ) const;
+    xmlDoc *to_xmlDoc( const std::string&, bool, bool = true ) const;
+    std::string to_xml_string( const std::string&, bool ) const;
+    bool to_xml_file( const std::string&, const std::string&, bool ) const;
+    struct output_state {
+      /// the state of a serialization, running on this thread
+      const Document *doc = 0;
+      xmlNs *ns = 0;          ///< the output namespace
+      bool preserve_spaces = false;
+    };
+    static thread_local output_state _output;
     void add_one_anno( const std::pair<AnnotationType,std::string>&,
 		       xmlNode * ) const;
     void internal_declare( AnnotationType,
@@ -483,7 +534,6 @@ namespace folia {
     xmlDoc *_xmldoc;
     const xmlChar* _foliaNsIn_href;
     const xmlChar* _foliaNsIn_prefix;
-    mutable xmlNs *_foliaNsOut;
     Provenance *_provenance;
     MetaData *_metadata;
     ForeignMetaData *_foreign_metadata;
@@ -498,8 +548,23 @@ namespace folia {
     std::string _patch_version;
     bool _external_document;
     bool _incremental_parse;
-    bool _preserve_spaces;
-    mutable int _warn_count;
+    bool _trusted_input;
+    binary::MappedSource *_mapped;
+    std::set<ElementType> _lazy_types;
+    std::map<std::string,AbstractElement*> _deferred_ids; ///< in LAZY mode,
+    ///< the ids inside deferred subtrees, with the element that holds them
+    std::map<const FoliaElement*,size_t> _postponed; ///< in LAZY mode,
+    ///< the number of deferred subtrees below an element, for which the
+    ///< text checks still have to be done
+    std::vector<ParseJob> *_parse_jobs; ///< during a parallel parse, the
+    ///< deferred subtrees that are handed to the worker threads
+    unsigned int _parse_threads;
+    bool _concurrent_updates;
+    bool _declarations_frozen;
+    mutable std::recursive_mutex _shared_mutex; ///< guards the registries
+    ///< when _concurrent_updates is set
+    Metrics *_metrics;
+    mutable std::atomic<int> _warn_count;
     Document( const Document& ) = delete; // inhibit copies
     Document& operator=( const Document& ) = delete; // inhibit copies
   };
@@ -514,6 +579,7 @@ namespace folia {
   inline bool Document::canonical() const { return mode % DocMode::CANONICAL; };
   inline bool Document::autodeclare() const { return mode % DocMode::AUTODECLARE; };
   inline bool Document::has_explicit() const { return mode % DocMode::EXPLICIT; };
+  inline bool Document::lazy() const { return mode % DocMode::LAZY; };
 
   template <> inline
     Text *Document::create_root( const KWargs& args ){
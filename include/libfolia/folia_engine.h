@@ -32,10 +32,15 @@
 #include <set>
 #include <vector>
 #include <iostream>
+#include <functional>
 #include "ticcutils/LogStream.h"
 #include "libfolia/folia.h"
 #include "libxml/xmlreader.h"
 
+namespace TiCC {
+  class tmp_stream;
+}
+
 namespace folia {
 
   class xml_tree {
@@ -55,12 +60,53 @@ namespace folia {
 
   void print( std::ostream&, const xml_tree* );
 
+  class ElementMatcher {
+    /// a precompiled test for the nodes Engine::get_node() looks for
+    /*!
+      Testing an element costs one tag lookup and a bit test. The attribute
+      predicates are only evaluated for elements of a matching type. They
+      compare the attribute values literally, as found in the input.
+    */
+  public:
+    ElementMatcher(): _pi( false ), _holders_known( false ) {};
+    explicit ElementMatcher( const std::string& );
+    ElementMatcher& add( ElementType );
+    ElementMatcher& with_attribute( const std::string&, const std::string& );
+    ElementMatcher& with_set( const std::string& s ){
+      return with_attribute( "set", s );
+    };
+    ElementMatcher& with_class( const std::string& c ){
+      return with_attribute( "class", c );
+    };
+    ElementMatcher& with_textclass( const std::string& c ){
+      return with_attribute( "textclass", c );
+    };
+    bool matches( ElementType, xmlTextReader * ) const;
+    bool matches_pi() const { return _pi; };
+    bool may_contain( ElementType ) const;
+  private:
+    ElementTypeSet _types;
+    std::vector<std::pair<std::string,std::string>> _predicates;
+    bool _pi;
+    mutable bool _holders_known;       ///< is _holders computed?
+    mutable ElementTypeSet _holders;   ///< the types that may have a
+    ///< matching descendant
+  };
+
+  class raw_input;
+
   class Engine {
   public:
     /// the document type, determines the type of the top node (\<text> or \<speech>)
     enum class DocType { TEXT, //!< the topnode is \<text>
 			 SPEECH //!< the topnode is \<speech>
     };
+    /// when does the Engine output and delete the processed nodes by itself
+    enum class FlushPolicy { NONE,         //!< only on flush() or finish()
+			     TOP_NODES,    //!< every completed top level node
+			     ELEMENT_COUNT,//!< when more elements are held
+			     BYTE_BUDGET   //!< when more input is consumed
+    };
     Engine(); //!< default constructor. needs a call to init_doc() to get started
     explicit Engine( const std::string& i, const std::string& o="" ):
       Engine() {
@@ -72,14 +118,35 @@ namespace folia {
       Engine::init_doc(i,o);
     };
     virtual ~Engine();
+    /// the function that delivers the input for init_doc(), see there
+    using read_function = std::function<int(char*,int)>;
     virtual bool init_doc( const std::string&, const std::string& ="" );
+    virtual bool init_doc( const read_function&, const std::string& ="" );
+    bool init_doc( std::istream&, const std::string& ="" );
+    bool init_doc( int, const std::string& ="" );
+    virtual bool resume( const std::string&,
+			 const std::string&,
+			 const std::string& );
     FoliaElement *get_node( const std::string& );
+    FoliaElement *get_node( const ElementMatcher& );
+    /// the function process() calls on every matched subtree
+    using node_handler = std::function<void(FoliaElement*)>;
+    void process( const std::string&,
+		  const node_handler&,
+		  unsigned int = 0,
+		  size_t = 0 );
     bool next() { return true; }; /// A stub. NOT needed!
     void save( const std::string&, bool=false );
     void save( std::ostream&, bool=false );
     bool output_header();
     void output_footer();
     void flush();
+    void set_auto_flush( FlushPolicy, size_t = 0 );
+    void set_skip_scan( bool, const ElementTypeSet& = ElementTypeSet() );
+    std::vector<FoliaElement*> ancestors() const;
+    void set_passthrough( bool = true );
+    void set_checkpoint( const std::string&, size_t = 1 );
+    void set_scoped_references( bool = true );
     void finish();
     /// return the status of the Engine. True when still valid. False otherwise.
     bool ok() const { return _ok; };
@@ -118,6 +185,31 @@ namespace folia {
     bool _header_done;      //!< is the header outputed yet?
     bool _finished;         //!< did we finish the whole process?
     bool _debug;            //!< is debug on?
+    FlushPolicy _flush_policy; //!< the auto-flush policy
+    size_t _flush_limit;    //!< the element count or byte budget
+    size_t _held_nodes;     //!< the number of elements kept in _out_doc
+    long _flushed_bytes;    //!< the input bytes consumed at the last flush
+    std::vector<FoliaElement*> _open_nodes; //!< the nodes which start tag
+    ///< is already output, from the top level down
+    bool _skip_scan;        //!< only build the matched nodes?
+    ElementTypeSet _keep_types; //!< in skip scan mode: the ancestors to build
+    std::vector<std::pair<int,FoliaElement*>> _ancestors; //!< in skip scan
+    ///< mode: the open ancestors that are built, with their depth
+    raw_input *_raw;        //!< in passthrough mode: the raw input bytes
+    size_t _read_count;     //!< in passthrough mode: the number of elements
+    ///< and PI's the reader has met in the body
+    int _match_depth;       //!< in passthrough mode: the depth of the
+    ///< pending match
+    std::string _checkpoint_file; //!< where to write the checkpoints
+    size_t _checkpoint_every; //!< write one every this many top level nodes
+    size_t _top_nodes;      //!< the number of top level nodes met
+    size_t _last_checkpoint;  //!< _top_nodes at the last checkpoint
+    bool _at_resume_node;   //!< after resume(): the reader is positioned at
+    ///< the next node to handle
+    read_function _input;   //!< the input function, when not reading a file
+    bool _scoped_refs;      //!< resolve references within their \<s> or \<p>
+    std::string _last_tag;  //!< the tag of the last get_node() call
+    ElementMatcher _last_matcher; //!< the compiled version of _last_tag
 
     FoliaElement *handle_match( const std::string&, int );
     void handle_element( const std::string&, int );
@@ -127,6 +219,23 @@ namespace folia {
     void add_PI( int );
     void add_text( int );
     void append_node( FoliaElement *, int );
+    FoliaElement *skip_to_node( const ElementMatcher& );
+    void drop_ancestors( int );
+    FoliaElement *pass_to_node( const ElementMatcher& );
+    void output_match();
+    void new_doc( const std::string&, const std::string& );
+    bool read_header();
+    void top_node_start();
+    void write_checkpoint();
+    virtual void save_state( KWargs& ) const;
+    virtual void restore_state( const KWargs& );
+    void check_references( const FoliaElement * ) const;
+    void release( FoliaElement * );
+    void drop_reader_ids();
+    void auto_flush();
+    void flush_completed( bool );
+    void output_children( FoliaElement *, size_t, size_t );
+    void close_open_node();
   };
 
   class TextEngine: public Engine {
@@ -134,7 +243,10 @@ namespace folia {
     TextEngine(): Engine(), //!< default construcor. Needs a call to init_doc()
 		  _next_text_node(0),
 		  _node_count(0),
-		  _is_setup(false)
+		  _resume_node_count(-1),
+		  _resume_text_node(-1),
+		  _is_setup(false),
+		  _spool(0)
     {
     };
     explicit TextEngine( const std::string& i, const std::string& o="" ):
@@ -147,7 +259,13 @@ namespace folia {
       */
       TextEngine::init_doc( i, o );
     }
+    ~TextEngine() override;
+    using Engine::init_doc;
     bool init_doc( const std::string&, const std::string& ="" ) override;
+    bool init_doc( const read_function&, const std::string& ="" ) override;
+    bool resume( const std::string&,
+		 const std::string&,
+		 const std::string& ) override;
     void setup( const std::string& ="", bool = false );
     const std::map<int,int>& enumerate_text_parents( const std::string& ="",
 						     bool = false );
@@ -156,14 +274,20 @@ namespace folia {
       return text_parent_map.size();
     };
     FoliaElement *next_text_parent();
+  protected:
+    void save_state( KWargs& ) const override;
+    void restore_state( const KWargs& ) override;
   private:
     int _next_text_node;
     int _node_count;
+    int _resume_node_count; //!< _node_count from a checkpoint, or -1
+    int _resume_text_node;  //!< _next_text_node from a checkpoint, or -1
     std::string _in_file;
     std::map<int,int> text_parent_map;
     std::map<int,int> search_text_parents( const xml_tree*,
 					   const std::string&, bool ) const;
     bool _is_setup;
+    TiCC::tmp_stream *_spool; //!< a copy of the input, when read from a stream
   };
 
 }
@@ -32,6 +32,7 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <exception>
 #include "unicode/unistr.h"
@@ -70,6 +71,53 @@ namespace folia {
   class MetaData;
   class ProcessingInstruction;
   bool is_subtype( const ElementType& e1, const ElementType& e2 ); //from folia_properties
+  bool is_acceptable( const ElementType&, const ElementType& ); //from folia_properties
+  bool is_subclass( const ElementType&, const ElementType& ); //from folia_properties
+
+  template <typename T, typename = void>
+  struct element_type_of {
+    /// compile-time mapping of a C++ class to it's ElementType
+    /*!
+      This general version is for classes without an ElementType, like
+      AbstractElement or the Allow* mixins
+    */
+    static constexpr bool known = false;
+  };
+
+  template <typename T>
+  struct element_type_of<T, std::void_t<decltype(T::PROPS)>> {
+    /// the concrete FoLiA classes use the ELEMENT_ID of their PROPS
+    static constexpr bool known = true;
+    static ElementType value() { return T::PROPS.ELEMENT_ID; };
+  };
+
+#define ABSTRACT_ELEMENT_TYPE( CLASS )					\
+  class CLASS;								\
+  template <> struct element_type_of<CLASS> {				\
+    static constexpr bool known = true;					\
+    static constexpr ElementType value() { return ElementType::CLASS##_t; }; \
+  }
+
+  ABSTRACT_ELEMENT_TYPE( AbstractFeature );
+  ABSTRACT_ELEMENT_TYPE( AbstractWord );
+  ABSTRACT_ELEMENT_TYPE( AbstractAnnotationLayer );
+  ABSTRACT_ELEMENT_TYPE( AbstractContentAnnotation );
+  ABSTRACT_ELEMENT_TYPE( AbstractCorrectionChild );
+  ABSTRACT_ELEMENT_TYPE( AbstractHigherOrderAnnotation );
+  ABSTRACT_ELEMENT_TYPE( AbstractInlineAnnotation );
+  ABSTRACT_ELEMENT_TYPE( AbstractSpanAnnotation );
+  ABSTRACT_ELEMENT_TYPE( AbstractSpanRole );
+  ABSTRACT_ELEMENT_TYPE( AbstractStructureElement );
+  ABSTRACT_ELEMENT_TYPE( AbstractSubtokenAnnotation );
+  ABSTRACT_ELEMENT_TYPE( AbstractTextMarkup );
+
+#undef ABSTRACT_ELEMENT_TYPE
+
+  class DCOI;
+  template <> struct element_type_of<DCOI> {
+    /// DCOI shares the ElementType of FoLiA, so it can't be mapped
+    static constexpr bool known = false;
+  };
 
   /// class used to steer 'select()' behaviour
   enum class SELECT_FLAGS {
@@ -123,8 +171,18 @@ namespace folia {
 
     template <typename T>
     bool isSubClass() const {
-      const FoliaElement *tmp = dynamic_cast<const T*>(this);
-      return tmp != nullptr;
+      /// check if this node is an instance of C++ class T or a derivative
+      /*!
+	For the FoLiA classes this is a lookup in a table precomputed from
+	the class hierarchy. Other classes use a dynamic_cast.
+      */
+      if constexpr ( element_type_of<T>::known ){
+	return is_subclass( element_id(), element_type_of<T>::value() );
+      }
+      else {
+	const FoliaElement *tmp = dynamic_cast<const T*>(this);
+	return tmp != nullptr;
+      }
     }
 
     template <typename T>
@@ -167,6 +225,10 @@ namespace folia {
     virtual void set_parent( FoliaElement *p ) = 0;
     virtual bool acceptable( ElementType ) const = 0;
     virtual bool addable( const FoliaElement * ) const = 0;
+    virtual size_t count_children( ElementType,
+				   const std::string& = "" ) const = 0;
+    virtual bool has_text_class( const std::string&,
+				 const std::string& ) const = 0;
     virtual FoliaElement *append( FoliaElement* ) = 0;
     virtual FoliaElement *postappend( ) = 0;
     virtual void remove( FoliaElement * ) = 0;
@@ -580,10 +642,25 @@ namespace folia {
     static FoliaElement *private_createElement( ElementType );
   public:
     static FoliaElement *createElement( ElementType, Document * =0 );
-    static FoliaElement *createElement( const std::string&, Document * =0 );
+    static FoliaElement *createElement( std::string_view, Document * =0 );
 
   }; // class FoliaElement
 
+  class AbstractElement;
+
+  class DeferredSubtree {
+    /// interface for the source of the children of an element that are not
+    /// parsed yet.
+    /*!
+      A Document may postpone the parsing of the children of some elements.
+      Those elements carry a DeferredSubtree which is expanded on first
+      access to the children. This is not thread safe.
+    */
+  public:
+    virtual ~DeferredSubtree(){};
+    virtual void expand( AbstractElement * ) = 0;
+  };
+
   class AbstractElement: public virtual FoliaElement {
     friend void destroy( FoliaElement * );
   private:
@@ -600,7 +677,7 @@ namespace folia {
     void classInit( const KWargs& );
 
     //functions regarding contained data
-    size_t size() const override { return _data.size(); };
+    size_t size() const override { materialize(); return _data.size(); };
     FoliaElement* index( size_t ) const override;
     FoliaElement* opaque_index( size_t ) const override;
     FoliaElement* rindex( size_t ) const override;
@@ -620,7 +697,27 @@ namespace folia {
     void replace( FoliaElement * ) override;
     FoliaElement* replace( FoliaElement *, FoliaElement* ) override;
     void insert_after( FoliaElement *, FoliaElement * ) override;
-    const std::vector<FoliaElement*>& data() const override { return _data; };
+    size_t count_children( ElementType,
+			   const std::string& = "" ) const override;
+    bool has_text_class( const std::string&,
+			 const std::string& ) const override;
+    const std::vector<FoliaElement*>& data() const override {
+      materialize();
+      return _data;
+    };
+    bool is_deferred() const {
+      /// are the children of this node still waiting to be parsed?
+      return _deferred != 0;
+    };
+    void set_deferred( DeferredSubtree * );
+    void parse_children( const xmlNode * );
+    void check_after_parsing();
+    void materialize() const {
+      /// make sure the children of this node are parsed
+      if ( _deferred ){
+	expand_deferred();
+      }
+    };
 
     // Sentences
     Sentence *addSentence( const KWargs& ) override;
@@ -703,11 +800,17 @@ namespace folia {
 
     // attributes
     const std::string& cls() const override { return _class; };
-    void set_cls( const std::string& cls ) override { _class = cls; };
+    void set_cls( const std::string& cls ) override {
+      _class = cls;
+      invalidate_parent_counts();
+    };
     void update_cls( const std::string& c ){ set_cls( c ); } // deprecated
 
     const std::string& sett() const override { return _set; };
-    void set_set( const std::string& st ) override { _set = st; };
+    void set_set( const std::string& st ) override {
+      _set = st;
+      invalidate_parent_counts();
+    };
 
     const std::string& tag() const override { return _tags; };
     const std::string set_tag( const std::string&  ) override;
@@ -759,8 +862,8 @@ namespace folia {
     const std::string& xmltag() const override;
     const AnnotationType& annotation_type() const override;
     const std::string& default_subset() const override;
-    const std::set<ElementType>& accepted_data() const;
-    const std::set<ElementType>& required_data() const;
+    const ElementTypeSet& accepted_data() const;
+    const ElementTypeSet& required_data() const;
     const bool& printable() const override;
     const bool& speakable() const override;
     const bool& referable() const override;
@@ -825,6 +928,10 @@ namespace folia {
     void check_set_declaration();
     void addFeatureNodes( const KWargs& args );
     void dbg( const std::string& ) const;
+    void expand_deferred() const;
+    void count_child( const FoliaElement *, int ) const;
+    void recount_children() const;
+    void invalidate_parent_counts();
     Document *_mydoc;
     FoliaElement *_parent;
     bool _auth;
@@ -849,6 +956,19 @@ namespace folia {
     std::string _tags;
     SPACE_FLAGS _preserve_spaces;
     std::vector<FoliaElement*> _data;
+    struct child_count {
+      /// the number of children of a certain type, set and (for TextContent)
+      /// class
+      ElementType type;
+      std::string set;
+      std::string cls;
+      size_t count;
+    };
+    mutable std::vector<child_count> _child_counts; ///< one entry per
+    ///< distinct (type,set,class) in _data, maintained by append(), remove()
+    ///< etc.
+    mutable bool _counts_stale; ///< set when _child_counts must be rebuilt
+    mutable DeferredSubtree *_deferred;
     const properties& _props;
   }; // class AbstractElement
 
@@ -961,6 +1081,10 @@ namespace folia {
   public:
     void setMaxId( FoliaElement * );
     const std::string generateId( const std::string& tag ) override;
+    /// the counters generateId() uses, per tag
+    const std::map<std::string, int>& id_counters() const { return id_map; };
+    /// restore the counters generateId() uses
+    void set_id_counters( const std::map<std::string, int>& m ){ id_map = m; };
   private:
     std::map<std::string, int> id_map;
   };
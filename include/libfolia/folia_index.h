@@ -0,0 +1,95 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of libfolia
+
+  libfolia is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  libfolia is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+
+#ifndef FOLIA_INDEX_H
+#define FOLIA_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+
+namespace folia {
+  class Document;
+
+  class IndexError: public std::runtime_error {
+  public:
+    explicit IndexError( const std::string& s ):
+      std::runtime_error( "document index: " + s ){};
+  };
+
+  class DocumentIndex {
+    /// a sidecar index on a FoLiA XML file, for random access by xml:id
+    /*!
+      build() scans the file once, without parsing it into a Document, and
+      records for every element with an xml:id the byte range in the file,
+      and its chain of ancestors. extract() then reads just the header,
+      the start tags of the ancestors and the subtree, and parses those.
+
+      The index file is binary:
+      - 8 bytes magic "FoLiAidx"
+      - uint32 format version
+      - uint32 byte order mark
+      - uint64 size and uint64 modification time of the indexed file
+      - the name of the root element: an uint32 length followed by the bytes
+      - uint32 number of entries, followed per entry by an uint64 offset,
+        an uint64 length, an uint32 start tag length and the uint32 entry
+        number of the parent (NO_PARENT for the \<text> or \<speech> node)
+      - uint32 number of ids, followed per id by an uint32 length, the
+        bytes and the uint32 entry number
+    */
+  public:
+    static const uint32_t FORMAT_VERSION = 1;
+    static const uint32_t NO_PARENT = 0xFFFFFFFF;
+    DocumentIndex(): _source_size(0), _source_time(0) {};
+    void build( const std::string& );
+    void save( const std::string& ) const;
+    void load( const std::string&, const std::string& );
+    /// the number of indexed ids
+    size_t size() const { return _ids.size(); };
+    bool has( const std::string& ) const;
+    Document *extract( const std::string& ) const;
+  private:
+    struct entry {
+      uint64_t offset;     ///< the offset of the start tag in the file
+      uint64_t length;     ///< the length of the complete element
+      uint32_t tag_length; ///< the length of the start tag
+      uint32_t parent;     ///< the entry of the parent element
+    };
+    std::string _source;       ///< the indexed file
+    uint64_t _source_size;     ///< its size when indexed
+    uint64_t _source_time;     ///< its modification time when indexed
+    std::string _root_name;    ///< the qualified name of the root element
+    std::vector<entry> _entries;  ///< the indexed elements and their
+    ///< ancestors. The first one is the \<text> or \<speech> node
+    std::unordered_map<std::string,uint32_t> _ids; ///< id to entry
+  };
+
+} // namespace folia
+
+#endif // FOLIA_INDEX_H
@@ -0,0 +1,148 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of libfolia
+
+  libfolia is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  libfolia is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#ifndef FOLIA_METRICS_H
+#define FOLIA_METRICS_H
+
+#include <cstdint>
+#include <string>
+#include <array>
+#include <atomic>
+
+namespace folia {
+
+  /// the phases of reading and writing a Document that are timed
+  enum class Phase : unsigned int {
+    TOKENIZE,     ///< libxml2 turning the input into an xmlDoc
+    BUILD,        ///< building the FoLiA tree from the xmlDoc
+    DECLARATIONS, ///< checking annotation declarations
+    TEXT_CHECKS,  ///< checking text consistency and offsets
+    SERIALIZE,    ///< producing XML output
+    PHASE_COUNT
+  };
+
+  const unsigned int PHASE_COUNT =
+    static_cast<unsigned int>(Phase::PHASE_COUNT);
+
+  std::string toString( Phase );
+
+  /// the events that are counted
+  enum class Counter : unsigned int {
+    ELEMENTS_CREATED,   ///< elements added to the Document
+    SELECT_CALLS,       ///< calls of the generic select(), recursion included
+    NODES_VISITED,      ///< nodes examined by select()
+    TEXT_CALLS,         ///< text() computations
+    NO_SUCH_TEXT,       ///< NoSuchText exceptions thrown
+    INDEX_LOOKUPS,      ///< lookups in the id index
+    DECLARATION_CHECKS, ///< checks for an annotation declaration
+    BYTES_SERIALIZED,   ///< the size of the XML output
+    COUNTER_COUNT
+  };
+
+  const unsigned int COUNTER_COUNT =
+    static_cast<unsigned int>(Counter::COUNTER_COUNT);
+
+  std::string toString( Counter );
+
+  struct MetricsSnapshot {
+    /// a plain copy of the values in a Metrics object
+    std::array<double,PHASE_COUNT> wall{};       ///< seconds per Phase
+    std::array<double,PHASE_COUNT> cpu{};        ///< seconds per Phase
+    std::array<uint64_t,PHASE_COUNT> calls{};    ///< calls per Phase
+    std::array<uint64_t,COUNTER_COUNT> counts{}; ///< value per Counter
+  };
+
+  class Metrics {
+    /// the wall and CPU time spent in every Phase of a Document, and the
+    /// counted events
+    /*!
+      Times are exclusive: time spent in a nested phase (like the text checks
+      during the tree build) is only charged to the nested phase.
+      The CPU time is the time of the threads involved, so for a parallel
+      parse it may exceed the wall time.
+      All members may be updated from several threads at once.
+    */
+  public:
+    Metrics();
+    void reset();
+    void add( Phase, uint64_t, uint64_t, uint64_t = 0 );
+    double wall( Phase ) const;
+    double cpu( Phase ) const;
+    uint64_t calls( Phase ) const;
+    void count( Counter c, uint64_t n = 1 ){
+      /// add n to counter c
+      _counters[static_cast<unsigned int>(c)].fetch_add( n,
+							 std::memory_order_relaxed );
+    }
+    uint64_t counter( Counter ) const;
+    MetricsSnapshot snapshot() const;
+    std::string toJSON() const;
+  private:
+    struct phase_time {
+      std::atomic<uint64_t> wall_ns;
+      std::atomic<uint64_t> cpu_ns;
+      std::atomic<uint64_t> calls;
+    };
+    std::array<phase_time,PHASE_COUNT> _phases;
+    std::array<std::atomic<uint64_t>,COUNTER_COUNT> _counters;
+  };
+
+  class PhaseTimer {
+    /// charges the time of its lifetime on this thread to a Phase
+    /*!
+      Does nothing when the Metrics pointer is 0. So the cost of timing a
+      Document that doesn't collect metrics is just a test.
+      A timer for the same phase inside another one is ignored, so recursive
+      functions are counted once.
+    */
+  public:
+    PhaseTimer( Metrics *m, Phase p ):
+      _metrics(m), _phase(p), _outer(0), _wall(0), _cpu(0) {
+      if ( _metrics ){
+	start();
+      }
+    };
+    ~PhaseTimer(){
+      if ( _metrics ){
+	stop();
+      }
+    };
+  private:
+    PhaseTimer( const PhaseTimer& ) = delete;
+    PhaseTimer& operator=( const PhaseTimer& ) = delete;
+    void start();
+    void stop();
+    void charge( uint64_t, uint64_t, bool );
+    Metrics *_metrics;
+    Phase _phase;
+    PhaseTimer *_outer;
+    uint64_t _wall;
+    uint64_t _cpu;
+  };
+
+} // namespace folia
+
+#endif // FOLIA_METRICS_H
@@ -29,6 +29,11 @@
 
 #include <set>
 #include <string>
+#include <array>
+#include <bitset>
+#include <iterator>
+#include <initializer_list>
+#include "libfolia/folia_types.h"
 
 namespace folia {
   enum class ElementType : unsigned int;
@@ -36,13 +41,92 @@ namespace folia {
   enum class AnnotatorType: int;
   enum class AnnotationType : int;
 
+  class ElementTypeSet {
+    /// a set of ElementTypes, stored as a bitset
+    /*!
+      Used for the ACCEPTED_DATA and REQUIRED_DATA properties. Unlike a
+      std::set it needs no allocations, and copying it is cheap.
+    */
+  public:
+    static const size_t SIZE = static_cast<size_t>(ElementType::LastElement);
+    ElementTypeSet() = default;
+    ElementTypeSet( std::initializer_list<ElementType> l ){
+      for ( const auto& et : l ){
+	insert( et );
+      }
+    };
+    void insert( ElementType et ){ _bits.set( static_cast<size_t>(et) ); };
+    ElementTypeSet& operator+=( const ElementTypeSet& other ){
+      _bits |= other._bits;
+      return *this;
+    };
+    bool contains( ElementType et ) const {
+      return _bits.test( static_cast<size_t>(et) );
+    };
+    size_t count( ElementType et ) const { return contains( et ) ? 1 : 0; };
+    size_t size() const { return _bits.count(); };
+    bool empty() const { return _bits.none(); };
+    class const_iterator {
+      /// iterates over the members, in ElementType order
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = ElementType;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const ElementType*;
+      using reference = ElementType;
+      const_iterator( const ElementTypeSet *s, size_t pos ):
+	_set(s), _pos(pos) { skip(); };
+      ElementType operator*() const { return static_cast<ElementType>(_pos); };
+      const_iterator& operator++(){ ++_pos; skip(); return *this; };
+      const_iterator operator++(int){
+	const_iterator tmp = *this;
+	++*this;
+	return tmp;
+      };
+      bool operator==( const const_iterator& o ) const { return _pos == o._pos; };
+      bool operator!=( const const_iterator& o ) const { return _pos != o._pos; };
+    private:
+      void skip(){
+	while ( _pos < SIZE && !_set->_bits.test( _pos ) ){
+	  ++_pos;
+	}
+      };
+      const ElementTypeSet *_set;
+      size_t _pos;
+    };
+    const_iterator begin() const { return const_iterator( this, 0 ); };
+    const_iterator end() const { return const_iterator( this, SIZE ); };
+  private:
+    std::bitset<SIZE> _bits;
+  };
+
+  template <typename T>
+  class ElementTable {
+    /// a flat table holding one T per ElementType
+  public:
+    T& operator[]( ElementType et ){
+      return _table[static_cast<size_t>(et)];
+    };
+    const T& operator[]( ElementType et ) const {
+      return _table[static_cast<size_t>(et)];
+    };
+    typename std::array<T,ElementTypeSet::SIZE>::const_iterator begin() const {
+      return _table.begin();
+    };
+    typename std::array<T,ElementTypeSet::SIZE>::const_iterator end() const {
+      return _table.end();
+    };
+  private:
+    std::array<T,ElementTypeSet::SIZE> _table{};
+  };
+
   class properties {
    public:
     properties();
     ElementType ELEMENT_ID;
     std::string XMLTAG;
-    std::set<ElementType> ACCEPTED_DATA;
-    std::set<ElementType> REQUIRED_DATA;
+    ElementTypeSet ACCEPTED_DATA;
+    ElementTypeSet REQUIRED_DATA;
     Attrib REQUIRED_ATTRIBS;
     Attrib OPTIONAL_ATTRIBS;
     AnnotationType ANNOTATIONTYPE;
@@ -78,8 +162,8 @@ namespace folia {
   extern const std::map<AnnotationType,std::string> annotationtype_xml_map;
   extern const std::map<std::string,std::string> oldtags;
   extern std::map<std::string,std::string> reverse_old;
-  extern std::map<ElementType,properties*> element_props;
-  extern std::map<ElementType,ElementType> abstract_parents;
+  extern ElementTable<properties*> element_props;
+  extern ElementTable<ElementType> abstract_parents;
   extern const std::set<ElementType> default_ignore;
   extern const std::set<ElementType> default_ignore_annotations;
   extern const std::set<ElementType> default_ignore_structure;
@@ -95,9 +179,10 @@ namespace folia {
   extern const std::string NSIMDI;
   extern const std::string DEFAULT_TEXT_SET;
   extern const std::string DEFAULT_PHON_SET;
-  extern std::string host_name;
+  extern std::string host_name; // deprecated, use get_host_name()
 
   bool is_subtype( const ElementType&, const ElementType& );
+  bool is_acceptable( const ElementType&, const ElementType& );
   bool isAttributeFeature( const std::string& );
   void static_init();
   void print_type_hierarchy( std::ostream& );
@@ -27,6 +27,7 @@
 #ifndef TYPES_H
 #define TYPES_H
 #include <string>
+#include <string_view>
 #include "ticcutils/StringOps.h"
 #include "ticcutils/enum_flags.h"
 
@@ -168,7 +169,8 @@ LAST_ANN };
   std::string toString( const AnnotatorType& );
 
   std::string toString( const ElementType& );
-  ElementType stringToElementType( const std::string& );
+  ElementType stringToElementType( std::string_view );
+  bool lookupElementType( std::string_view, ElementType& );
 
   ElementType layertypeof( ElementType );
 
@@ -30,12 +30,16 @@
 #include <map>
 #include <set>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <iostream>
 #include <exception>
 #include <ctime>
 #include "unicode/unistr.h"
 #include <unicode/ustream.h>
 #include "libxml/tree.h"
+#include "libxml/parser.h"
+#include "libxml/xmlerror.h"
 
 #include "ticcutils/StringOps.h"
 #include "ticcutils/XMLtools.h"
@@ -170,6 +174,39 @@ namespace folia {
 			  + message ){};
   };
 
+  struct XmlDiagnostic {
+    /// one problem reported by libxml2 while parsing a document
+    int level = 0;        ///< the xmlErrorLevel: warning, error or fatal
+    int domain = 0;       ///< the xmlErrorDomain: parser, validity, I/O ...
+    int code = 0;         ///< the libxml2 error code
+    std::string file;     ///< the file name, when known
+    int line = 0;         ///< the line number, 0 when unknown
+    int column = 0;       ///< the column number, 0 when unknown
+    std::string message;  ///< the message of libxml2
+    std::string context;  ///< the offending node and a marker. (only
+                          ///< filled for the first problem of a parse)
+    std::string toString() const;
+  };
+
+  class XmlParseError: public DocumentError {
+    /// thrown when libxml2 reported problems while reading a document
+    /*!
+      what() describes the first problem, diagnostics() holds the details
+      of all stored ones
+    */
+  public:
+    XmlParseError( const std::string&,
+		   const std::vector<XmlDiagnostic>&,
+		   size_t );
+    const std::vector<XmlDiagnostic>& diagnostics() const {
+      return _diagnostics;
+    };
+    size_t count() const { return _count; };
+  private:
+    std::vector<XmlDiagnostic> _diagnostics;
+    size_t _count;
+  };
+
   ///
   /// KWargs is a class to hold attribute/value entries,
   ///
@@ -178,13 +215,18 @@ namespace folia {
   ///
   /// KWargs is a map, so it kan be indexed (on attribute), iterated etc.
   ///
-  class KWargs : public std::map<std::string, std::string> {
+  class KWargs : public std::map<std::string, std::string, std::less<>> {
+    /// an attribute-value list.
+    /*!
+      The comparator is transparent, so attributes can be looked up using
+      a string literal or a string_view, without building a std::string
+    */
   public:
     explicit KWargs( const std::string& ="" );
     KWargs( const std::string&, const std::string& );
-    bool is_present( const std::string& ) const;
-    std::string lookup( const std::string& ) const;
-    std::string extract( const std::string& );
+    bool is_present( std::string_view ) const;
+    std::string lookup( std::string_view ) const;
+    std::string extract( std::string_view );
     std::string toString();
     bool add( const std::string&, const std::string& );
     bool replace( const std::string&, const std::string& );
@@ -209,6 +251,20 @@ namespace folia {
   bool document_sanity_check();
   bool space_sanity_check();
   bool subclass_sanity_check();
+  bool binary_sanity_check();
+  bool lazy_sanity_check();
+  bool parallel_sanity_check();
+  bool concurrency_sanity_check();
+  bool engine_sanity_check();
+  bool engine_flush_sanity_check();
+  bool engine_prologue_sanity_check();
+  bool engine_matcher_sanity_check();
+  bool engine_skip_scan_sanity_check();
+  bool engine_passthrough_sanity_check();
+  bool engine_checkpoint_sanity_check();
+  bool engine_stream_sanity_check();
+  bool engine_scope_sanity_check();
+  bool index_sanity_check();
 
   ///
   /// some xml goodies
@@ -225,6 +281,41 @@ namespace folia {
     return std::string( reinterpret_cast<const char *>(in), size );
   }
 
+  inline std::string_view to_string_view( const xmlChar *in ){
+    /// a view on an xmlChar string, without copying it
+    if ( !in ){
+      return std::string_view();
+    }
+    return std::string_view( reinterpret_cast<const char *>(in) );
+  }
+
+  class XmlParseContext {
+    /// a libxml2 parser context that collects its own diagnostics
+    /*!
+      The error handler is attached to the xmlParserCtxt of this parse only,
+      not to the (thread) global state of libxml2. So any number of parses
+      may run at the same time, and nothing is written to stderr.
+      All problems are counted, the first \e max_kept are stored.
+    */
+  public:
+    explicit XmlParseContext( size_t max_kept = 100 );
+    ~XmlParseContext();
+    xmlDoc *read_file( const std::string&, int );
+    xmlDoc *read_memory( const std::string&, const std::string&, int );
+    size_t count() const { return _count; };
+    const std::vector<XmlDiagnostic>& diagnostics() const {
+      return _diagnostics;
+    };
+    static void sink( void *, const xmlError * );
+  private:
+    XmlParseContext( const XmlParseContext& ) = delete;
+    XmlParseContext& operator=( const XmlParseContext& ) = delete;
+    xmlParserCtxt *_ctxt;
+    size_t _max_kept;
+    size_t _count;
+    std::vector<XmlDiagnostic> _diagnostics;
+  };
+
   using TiCC::TextValue;
   using TiCC::isNCName;
 
@@ -238,6 +329,8 @@ namespace folia {
 
   std::string get_ISO_date();
   std::string get_fqdn();
+  std::string get_host_name();
+  void set_host_name( const std::string& );
   std::string get_user();
 
 } // namespace folia
@@ -0,0 +1,848 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of libfolia
+
+  libfolia is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  libfolia is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <tuple>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "libxml/tree.h"
+#include "ticcutils/StringOps.h"
+#include "libfolia/folia.h"
+#include "libfolia/folia_binary.h"
+
+using namespace std;
+
+namespace folia {
+
+  class Document::TrustedParse {
+    /// switch off the checks while a validated snapshot is parsed
+    /*!
+      checktext(), fixtext() and trusted_input() are restored when the
+      guard goes out of scope, also when the parse throws. Guards may nest,
+      as expanding a subtree can expand a deferred one below it.
+    */
+  public:
+    explicit TrustedParse( Document *doc ):
+      _doc( doc ),
+      _old_check( doc->set_checktext( false ) ),
+      _old_fix( doc->set_fixtext( false ) ),
+      _old_trusted( doc->_trusted_input )
+    {
+      _doc->_trusted_input = true;
+    }
+    ~TrustedParse(){
+      _doc->set_checktext( _old_check );
+      _doc->set_fixtext( _old_fix );
+      _doc->_trusted_input = _old_trusted;
+    }
+    TrustedParse( const TrustedParse& ) = delete;
+    TrustedParse& operator=( const TrustedParse& ) = delete;
+  private:
+    Document *_doc;
+    bool _old_check;
+    bool _old_fix;
+    bool _old_trusted;
+  };
+
+  namespace binary {
+
+    const char MAGIC[8] = { 'F', 'o', 'L', 'i', 'A', 'b', 'i', 'n' };
+    const uint32_t BYTE_ORDER_MARK = 0x01020304;
+    const uint64_t ID_ENTRY_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+
+    void put_u8( string& out, uint8_t v ){
+      out += static_cast<char>(v);
+    }
+
+    void put_u32( string& out, uint32_t v ){
+      char buf[sizeof(v)];
+      memcpy( buf, &v, sizeof(v) );
+      out.append( buf, sizeof(v) );
+    }
+
+    void put_u64( string& out, uint64_t v ){
+      char buf[sizeof(v)];
+      memcpy( buf, &v, sizeof(v) );
+      out.append( buf, sizeof(v) );
+    }
+
+    void patch_u64( string& out, size_t pos, uint64_t v ){
+      memcpy( &out[pos], &v, sizeof(v) );
+    }
+
+    Cursor::Cursor( const char *b, size_t len ):
+      pos(b),
+      end(b+len)
+    {
+    }
+
+    void Cursor::need( size_t len ) const {
+      if ( len > static_cast<size_t>(end - pos) ){
+	throw BinaryFormatError( "unexpected end of data" );
+      }
+    }
+
+    uint8_t Cursor::u8(){
+      need( 1 );
+      return static_cast<uint8_t>(*pos++);
+    }
+
+    uint32_t Cursor::u32(){
+      uint32_t v;
+      need( sizeof(v) );
+      memcpy( &v, pos, sizeof(v) );
+      pos += sizeof(v);
+      return v;
+    }
+
+    uint64_t Cursor::u64(){
+      uint64_t v;
+      need( sizeof(v) );
+      memcpy( &v, pos, sizeof(v) );
+      pos += sizeof(v);
+      return v;
+    }
+
+    void Cursor::skip( uint64_t len ){
+      need( len );
+      pos += len;
+    }
+
+    class Writer {
+      /// helper class to encode an xmlDoc into the binary snapshot format
+    public:
+      uint32_t intern( const xmlChar * );
+      void encode_node( const xmlNode * );
+      void encode_ns( const xmlNs * );
+      string strings;
+      string nodes;
+      uint32_t string_count = 0;
+      vector<tuple<string,uint32_t,uint64_t>> ids; ///< per xml:id: the
+      ///< index of the id in the string table and the offset of its element
+    private:
+      unordered_map<string,uint32_t> table;
+    };
+
+    uint32_t Writer::intern( const xmlChar *s ){
+      /// add a string to the string table
+      /*!
+	\param s the string to store. may be 0
+	\return the index in the string table. 0 is reserved for 'no string'.
+       */
+      if ( !s ){
+	return 0;
+      }
+      string key = reinterpret_cast<const char*>(s);
+      auto it = table.find( key );
+      if ( it != table.end() ){
+	return it->second;
+      }
+      uint32_t idx = ++string_count;
+      table.emplace( key, idx );
+      put_u32( strings, key.size() );
+      strings += key;
+      return idx;
+    }
+
+    void Writer::encode_ns( const xmlNs *ns ){
+      /// store a namespace reference as a (prefix,href) pair
+      if ( ns ){
+	put_u32( nodes, intern( ns->prefix ) );
+	put_u32( nodes, intern( ns->href ) );
+      }
+      else {
+	put_u32( nodes, 0 );
+	put_u32( nodes, 0 );
+      }
+    }
+
+    void Writer::encode_node( const xmlNode *node ){
+      /// encode an xmlNode and its children recursively
+      /*!
+	Each element record stores the size of its children block, so a reader
+	can skip a complete subtree without decoding it.
+       */
+      switch ( node->type ){
+      case XML_ELEMENT_NODE: {
+	uint64_t rec_pos = nodes.size();
+	put_u8( nodes, ELEMENT_REC );
+	put_u32( nodes, intern( node->name ) );
+	encode_ns( node->ns );
+	uint32_t cnt = 0;
+	for ( const xmlNs *ns = node->nsDef; ns; ns = ns->next ){
+	  ++cnt;
+	}
+	put_u32( nodes, cnt );
+	for ( const xmlNs *ns = node->nsDef; ns; ns = ns->next ){
+	  encode_ns( ns );
+	}
+	cnt = 0;
+	for ( const xmlAttr *a = node->properties; a; a = a->next ){
+	  ++cnt;
+	}
+	put_u32( nodes, cnt );
+	for ( const xmlAttr *a = node->properties; a; a = a->next ){
+	  put_u32( nodes, intern( a->name ) );
+	  encode_ns( a->ns );
+	  xmlChar *val = xmlNodeListGetString( node->doc, a->children, 1 );
+	  uint32_t index = intern( val );
+	  put_u32( nodes, index );
+	  if ( val
+	       && a->ns && a->ns->prefix
+	       && xmlStrEqual( a->ns->prefix, (const xmlChar*)"xml" )
+	       && xmlStrEqual( a->name, (const xmlChar*)"id" ) ){
+	    ids.emplace_back( reinterpret_cast<const char*>(val), index, rec_pos );
+	  }
+	  xmlFree( val );
+	}
+	size_t len_pos = nodes.size();
+	put_u64( nodes, 0 );
+	size_t start = nodes.size();
+	for ( const xmlNode *c = node->children; c; c = c->next ){
+	  encode_node( c );
+	}
+	put_u8( nodes, END_REC );
+	patch_u64( nodes, len_pos, nodes.size() - start );
+      }
+	break;
+      case XML_TEXT_NODE:
+	put_u8( nodes, TEXT_REC );
+	put_u32( nodes, intern( node->content ) );
+	break;
+      case XML_CDATA_SECTION_NODE:
+	put_u8( nodes, CDATA_REC );
+	put_u32( nodes, intern( node->content ) );
+	break;
+      case XML_COMMENT_NODE:
+	put_u8( nodes, COMMENT_REC );
+	put_u32( nodes, intern( node->content ) );
+	break;
+      case XML_PI_NODE:
+	put_u8( nodes, PI_REC );
+	put_u32( nodes, intern( node->name ) );
+	put_u32( nodes, intern( node->content ) );
+	break;
+      case XML_ENTITY_REF_NODE: {
+	xmlChar *val = xmlNodeGetContent( node );
+	put_u8( nodes, TEXT_REC );
+	put_u32( nodes, intern( val ) );
+	xmlFree( val );
+      }
+	break;
+      default:
+	// DTD nodes, XInclude markers etc. are not part of a FoLiA tree
+	break;
+      }
+    }
+
+    string encode( const xmlDoc *doc ){
+      /// encode a complete xmlDoc into a binary snapshot
+      /*!
+	\param doc the document to encode
+	\return a string holding the snapshot
+       */
+      Writer w;
+      for ( const xmlNode *n = doc->children; n; n = n->next ){
+	w.encode_node( n );
+      }
+      put_u8( w.nodes, END_REC );
+      string result( MAGIC, sizeof(MAGIC) );
+      put_u32( result, FORMAT_VERSION );
+      put_u32( result, BYTE_ORDER_MARK );
+      put_u32( result, w.string_count );
+      put_u64( result, w.strings.size() );
+      result += w.strings;
+      put_u64( result, w.nodes.size() );
+      result += w.nodes;
+      sort( w.ids.begin(), w.ids.end() );
+      put_u32( result, w.ids.size() );
+      for ( const auto& [id,index,offset] : w.ids ){
+	put_u32( result, index );
+	put_u64( result, offset );
+      }
+      return result;
+    }
+
+    Snapshot::Snapshot( const char *buf, size_t len ):
+      nodes( buf, 0 ),
+      id_table( 0 ),
+      id_count( 0 )
+    {
+      /// check the header of a binary snapshot and index the string table
+      /*!
+	\param buf the raw snapshot data. Must remain valid for the lifetime
+	of this object
+	\param len the size of buf
+       */
+      Cursor c( buf, len );
+      c.need( sizeof(MAGIC) );
+      if ( memcmp( c.pos, MAGIC, sizeof(MAGIC) ) != 0 ){
+	throw BinaryFormatError( "not a FoLiA binary snapshot" );
+      }
+      c.skip( sizeof(MAGIC) );
+      uint32_t version = c.u32();
+      if ( version == 0 || version > FORMAT_VERSION ){
+	throw BinaryFormatError( "unsupported snapshot version "
+				 + TiCC::toString(version) + " (expected "
+				 + TiCC::toString(FORMAT_VERSION) + ")" );
+      }
+      if ( c.u32() != BYTE_ORDER_MARK ){
+	throw BinaryFormatError( "snapshot was created on a machine with a different byte order" );
+      }
+      uint32_t count = c.u32();
+      uint64_t str_size = c.u64();
+      Cursor sc( c.pos, str_size );
+      c.skip( str_size );
+      strings.reserve( count + 1 );
+      strings.push_back( 0 );
+      lengths.reserve( count + 1 );
+      lengths.push_back( 0 );
+      for ( uint32_t i=0; i < count; ++i ){
+	uint32_t slen = sc.u32();
+	sc.need( slen );
+	strings.push_back( sc.pos );
+	lengths.push_back( slen );
+	sc.skip( slen );
+      }
+      uint64_t node_size = c.u64();
+      c.need( node_size );
+      nodes = Cursor( c.pos, node_size );
+      c.skip( node_size );
+      if ( version > 1 ){
+	id_count = c.u32();
+	c.need( uint64_t(id_count) * ID_ENTRY_SIZE );
+	id_table = c.pos;
+      }
+    }
+
+    bool Snapshot::find_id( const string& id, uint64_t& offset ) const {
+      /// lookup the position of the element with xml:id id
+      /*!
+	\param id the id to search
+	\param offset the offset of the element record in the node stream
+	\return true when found
+       */
+      uint32_t low = 0;
+      uint32_t high = id_count;
+      while ( low < high ){
+	uint32_t mid = low + (high-low)/2;
+	Cursor c( id_table + uint64_t(mid)*ID_ENTRY_SIZE, ID_ENTRY_SIZE );
+	uint32_t idx = c.u32();
+	if ( idx >= strings.size() ){
+	  throw BinaryFormatError( "string index out of range" );
+	}
+	int cmp = id.compare( 0, string::npos, strings[idx], lengths[idx] );
+	if ( cmp == 0 ){
+	  offset = c.u64();
+	  return true;
+	}
+	else if ( cmp < 0 ){
+	  high = mid;
+	}
+	else {
+	  low = mid + 1;
+	}
+      }
+      return false;
+    }
+
+    string Snapshot::str( uint32_t idx ) const {
+      /// return the string with index idx from the string table
+      if ( idx >= strings.size() ){
+	throw BinaryFormatError( "string index out of range" );
+      }
+      return string( strings[idx], lengths[idx] );
+    }
+
+    xmlChar *Snapshot::xml_str( uint32_t idx ) const {
+      /// return a fresh copy of string idx, or 0 for the empty index
+      if ( idx == 0 ){
+	return 0;
+      }
+      if ( idx >= strings.size() ){
+	throw BinaryFormatError( "string index out of range" );
+      }
+      return xmlStrndup( reinterpret_cast<const xmlChar*>(strings[idx]),
+			 lengths[idx] );
+    }
+
+    static xmlNs *lookup_ns( xmlDoc *doc,
+			     xmlNode *node,
+			     const xmlChar *prefix,
+			     const xmlChar *href ){
+      /// find (or create) the namespace (prefix,href) in scope of node
+      xmlNs *ns = xmlSearchNs( doc, node, prefix );
+      if ( ns && xmlStrEqual( ns->href, href ) ){
+	return ns;
+      }
+      return xmlNewNs( node, href, prefix );
+    }
+
+    void Snapshot::decode_element( Cursor& c,
+				   xmlDoc *doc,
+				   xmlNode *parent,
+				   Deferral *deferral ) const {
+      /// decode an element record, and add it to parent (or the document)
+      xmlChar *name = xml_str( c.u32() );
+      xmlChar *ns_prefix = xml_str( c.u32() );
+      xmlChar *ns_href = xml_str( c.u32() );
+      xmlNode *node = xmlNewDocNode( doc, 0, name, 0 );
+      xmlFree( name );
+      if ( parent ){
+	xmlAddChild( parent, node );
+      }
+      else {
+	xmlAddChild( reinterpret_cast<xmlNode*>(doc), node );
+      }
+      uint32_t cnt = c.u32();
+      for ( uint32_t i=0; i < cnt; ++i ){
+	xmlChar *pref = xml_str( c.u32() );
+	xmlChar *href = xml_str( c.u32() );
+	xmlNewNs( node, href, pref );
+	xmlFree( pref );
+	xmlFree( href );
+      }
+      if ( ns_href ){
+	xmlSetNs( node, lookup_ns( doc, node, ns_prefix, ns_href ) );
+      }
+      xmlFree( ns_prefix );
+      xmlFree( ns_href );
+      cnt = c.u32();
+      for ( uint32_t i=0; i < cnt; ++i ){
+	xmlChar *att = xml_str( c.u32() );
+	xmlChar *pref = xml_str( c.u32() );
+	xmlChar *href = xml_str( c.u32() );
+	xmlChar *val = xml_str( c.u32() );
+	if ( href ){
+	  xmlNewNsProp( node, lookup_ns( doc, node, pref, href ), att, val );
+	}
+	else {
+	  xmlNewProp( node, att, val );
+	}
+	xmlFree( att );
+	xmlFree( pref );
+	xmlFree( href );
+	xmlFree( val );
+      }
+      uint64_t size = c.u64();
+      if ( deferral
+	   && size > 1
+	   && deferral->tags.find( reinterpret_cast<const char*>(node->name) )
+	   != deferral->tags.end() ){
+	uint64_t offset = c.pos - nodes.pos;
+	c.skip( size );
+	deferral->pending[node] = make_pair( offset, size );
+      }
+      else {
+	decode_children( c, doc, node, deferral );
+      }
+    }
+
+    void Snapshot::decode_children( Cursor& c,
+				    xmlDoc *doc,
+				    xmlNode *parent,
+				    Deferral *deferral ) const {
+      /// decode records up to the matching END_REC and add them to parent
+      while ( true ){
+	uint8_t rec = c.u8();
+	switch ( rec ){
+	case END_REC:
+	  return;
+	case ELEMENT_REC:
+	  decode_element( c, doc, parent, deferral );
+	  break;
+	case TEXT_REC:
+	case CDATA_REC:
+	case COMMENT_REC: {
+	  xmlChar *val = xml_str( c.u32() );
+	  xmlNode *n;
+	  if ( rec == TEXT_REC ){
+	    n = xmlNewDocText( doc, val );
+	  }
+	  else if ( rec == CDATA_REC ){
+	    n = xmlNewCDataBlock( doc, val, xmlStrlen(val) );
+	  }
+	  else {
+	    n = xmlNewDocComment( doc, val );
+	  }
+	  xmlFree( val );
+	  xmlAddChild( parent?parent:reinterpret_cast<xmlNode*>(doc), n );
+	}
+	  break;
+	case PI_REC: {
+	  xmlChar *name = xml_str( c.u32() );
+	  xmlChar *val = xml_str( c.u32() );
+	  xmlNode *n = xmlNewDocPI( doc, name, val );
+	  xmlFree( name );
+	  xmlFree( val );
+	  xmlAddChild( parent?parent:reinterpret_cast<xmlNode*>(doc), n );
+	}
+	  break;
+	default:
+	  throw BinaryFormatError( "corrupt node record (type="
+				   + TiCC::toString(int(rec)) + ")" );
+	}
+      }
+    }
+
+    xmlDoc *Snapshot::to_xmlDoc( Deferral *deferral ) const {
+      /// rebuild the xmlDoc from the snapshot
+      /*!
+	\param deferral when not 0, the children of the elements with a tag in
+	deferral->tags are skipped and registered in deferral->pending
+	\return a new xmlDoc
+       */
+      xmlDoc *doc = xmlNewDoc( reinterpret_cast<const xmlChar*>("1.0") );
+      Cursor c = nodes;
+      try {
+	decode_children( c, doc, 0, deferral );
+      }
+      catch ( ... ){
+	xmlFreeDoc( doc );
+	throw;
+      }
+      return doc;
+    }
+
+    MappedSource::MappedSource( const string& file_name,
+				const set<string>& lazy_tags ):
+      map( MAP_FAILED ),
+      map_size( 0 ),
+      snap( 0 )
+    {
+      /// map a snapshot file read-only in memory
+      /*!
+	\param file_name the snapshot to map
+	\param lazy_tags the tags of the elements which children are decoded
+	on demand
+       */
+      int fd = open( file_name.c_str(), O_RDONLY );
+      if ( fd < 0 ){
+	throw invalid_argument( "file not found: " + file_name );
+      }
+      struct stat st;
+      if ( fstat( fd, &st ) != 0 || st.st_size == 0 ){
+	close( fd );
+	throw BinaryFormatError( "unable to map an empty file" );
+      }
+      map_size = st.st_size;
+      map = mmap( 0, map_size, PROT_READ, MAP_SHARED, fd, 0 );
+      close( fd );
+      if ( map == MAP_FAILED ){
+	throw runtime_error( "unable to map file: " + file_name );
+      }
+      try {
+	snap = new Snapshot( static_cast<const char*>(map), map_size );
+      }
+      catch ( ... ){
+	munmap( map, map_size );
+	throw;
+      }
+      deferral.tags = lazy_tags;
+    }
+
+    MappedSource::~MappedSource(){
+      delete snap;
+      if ( map != MAP_FAILED ){
+	munmap( map, map_size );
+      }
+    }
+
+    xmlDoc *MappedSource::skeleton(){
+      /// decode the document, except for the deferred subtrees
+      xmlDoc *doc = snap->to_xmlDoc( &deferral );
+      xmlNode *root = xmlDocGetRootElement( doc );
+      if ( root ){
+	for ( const xmlNs *ns = root->nsDef; ns; ns = ns->next ){
+	  root_ns.push_back( make_pair( ns->prefix?(const char*)ns->prefix:"",
+					(const char*)ns->href ) );
+	}
+      }
+      return doc;
+    }
+
+    bool MappedSource::defer( AbstractElement *el, const xmlNode *node ){
+      /// attach a BinarySubtree to el, when node was deferred while decoding
+      /*!
+	\param el the element being parsed
+	\param node the xmlNode el is parsed from
+	\return true when the children of el are deferred
+       */
+      auto it = deferral.pending.find( node );
+      if ( it == deferral.pending.end() ){
+	return false;
+      }
+      auto [start,size] = it->second;
+      deferral.pending.erase( it );
+      el->set_deferred( new BinarySubtree( this, start, size ) );
+      open_ranges[start] = make_pair( start+size, el );
+      return true;
+    }
+
+    void MappedSource::release( uint64_t start ){
+      /// forget the deferred subtree at start
+      open_ranges.erase( start );
+    }
+
+    void MappedSource::expand( AbstractElement *el,
+			       uint64_t start,
+			       uint64_t size ){
+      /// decode and parse the children block at start and append it to el
+      xmlDoc *tmp = xmlNewDoc( reinterpret_cast<const xmlChar*>("1.0") );
+      xmlNode *holder = xmlNewDocNode( tmp, 0,
+				       reinterpret_cast<const xmlChar*>("deferred"),
+				       0 );
+      xmlDocSetRootElement( tmp, holder );
+      for ( const auto& [prefix,href] : root_ns ){
+	xmlNewNs( holder,
+		  reinterpret_cast<const xmlChar*>(href.c_str()),
+		  prefix.empty()?0:reinterpret_cast<const xmlChar*>(prefix.c_str()) );
+      }
+      try {
+	Cursor c( snap->nodes.pos + start, size );
+	snap->decode_children( c, tmp, holder, &deferral );
+	// the snapshot is already validated
+	Document::TrustedParse trusted( el->doc() );
+	el->parse_children( holder );
+      }
+      catch ( ... ){
+	xmlFreeDoc( tmp );
+	throw;
+      }
+      xmlFreeDoc( tmp );
+    }
+
+    bool MappedSource::expand_for( const string& id ){
+      /// expand the deferred subtree that contains the element with this id
+      /*!
+	\param id the id to search for
+	\return true when a subtree was expanded. The id might be in a
+	nested deferred subtree, so the caller should retry the lookup.
+       */
+      uint64_t offset;
+      if ( !snap->find_id( id, offset ) ){
+	return false;
+      }
+      auto it = open_ranges.upper_bound( offset );
+      if ( it == open_ranges.begin() ){
+	return false;
+      }
+      --it;
+      if ( offset >= it->second.first ){
+	return false;
+      }
+      it->second.second->materialize();
+      return true;
+    }
+
+    BinarySubtree::BinarySubtree( MappedSource *src,
+				  uint64_t st,
+				  uint64_t sz ):
+      source( src ),
+      start( st ),
+      size( sz )
+    {
+    }
+
+    BinarySubtree::~BinarySubtree(){
+      source->release( start );
+    }
+
+    void BinarySubtree::expand( AbstractElement *el ){
+      source->release( start );
+      source->expand( el, start, size );
+    }
+
+  } // namespace binary
+
+  bool Document::save_binary( ostream& os ) const {
+    /// save the Document as a binary snapshot to a stream
+    /*!
+      \param os the output stream
+      \return true on success
+
+      The snapshot holds the same information as the XML serialization, but
+      with all tag names, attributes and texts stored in an interned string
+      table. It can be read back with load_binary()
+    */
+    xmlDoc *outDoc = to_xmlDoc( "", canonical() );
+    string buf;
+    try {
+      buf = binary::encode( outDoc );
+    }
+    catch ( ... ){
+      xmlFreeDoc( outDoc );
+      throw;
+    }
+    xmlFreeDoc( outDoc );
+    os.write( buf.data(), buf.size() );
+    os.flush();
+    return os.good();
+  }
+
+  bool Document::save_binary( const string& file_name ) const {
+    /// save the Document as a binary snapshot to a file
+    /*!
+      \param file_name the name of the file to create
+      \return true on success
+    */
+    ofstream os( file_name, ios::binary );
+    if ( !os.good() ){
+      throw runtime_error( "saving to file " + file_name + " failed" );
+    }
+    return save_binary( os );
+  }
+
+  bool Document::load_binary( const char *buf, size_t len ){
+    /// read a Document from a binary snapshot in memory
+    /*!
+      \param buf the snapshot data
+      \param len the size of buf
+      \return true on succes. Will throw otherwise.
+
+      A snapshot is created from an already validated Document, so the
+      expensive declaration and text consistency checks are skipped. The
+      checktext() and fixtext() modes of the Document are restored afterwards,
+      so they apply to later modifications.
+    */
+    if ( foliadoc ){
+      throw logic_error( "Document is already initialized" );
+    }
+    binary::Snapshot snap( buf, len );
+    _xmldoc = snap.to_xmlDoc();
+    if ( debug % DEBUG_FLAGS::PARSING ){
+      cout << "read a binary snapshot from " << _source_name << endl;
+    }
+    try {
+      TrustedParse trusted( this );
+      foliadoc = parseXml();
+    }
+    catch ( ... ){
+      xmlFreeDoc( _xmldoc );
+      _xmldoc = 0;
+      throw;
+    }
+    xmlFreeDoc( _xmldoc );
+    _xmldoc = 0;
+    return foliadoc != 0;
+  }
+
+  bool Document::load_binary( istream& is ){
+    /// read a Document from a binary snapshot on a stream
+    /*!
+      \param is the input stream
+      \return true on succes. Will throw otherwise.
+    */
+    stringstream ss;
+    ss << is.rdbuf();
+    string buf = ss.str();
+    if ( _source_name.empty() ){
+      _source_name = "binary-stream";
+    }
+    return load_binary( buf.data(), buf.size() );
+  }
+
+  bool Document::load_binary( const string& file_name ){
+    /// read a Document from a binary snapshot file
+    /*!
+      \param file_name the name of the file, created by save_binary()
+      \return true on succes. Will throw otherwise.
+    */
+    ifstream is( file_name, ios::binary );
+    if ( !is.good() ){
+      throw invalid_argument( "file not found: " + file_name );
+    }
+    _source_name = file_name;
+    try {
+      return load_binary( is );
+    }
+    catch ( const binary::BinaryFormatError& e ){
+      throw DocumentError( file_name, e.what() );
+    }
+  }
+
+  bool Document::map_binary( const string& file_name ){
+    /// map a binary snapshot file in memory, parsing subtrees on demand
+    /*!
+      \param file_name the name of the file, created by save_binary()
+      \return true on succes. Will throw otherwise.
+
+      The file is mapped read-only, so multiple processes share the same
+      pages. Only the elements outside subtrees with a type in lazy_types()
+      are created immediately. The children of the others are parsed when
+      they are first accessed: through iteration, select(), text() or
+      when one of their descendants is looked up with index().
+
+      Only the bytes of the subtrees that are not expanded yet are shared.
+      An expanded subtree is a normal heap copy, private to the process.
+      The Document itself is NOT read-only: it is lazily loaded, and may
+      be modified like any other. The changes are never written back to
+      the file.
+      \note expanding subtrees is not thread safe
+    */
+    if ( foliadoc ){
+      throw logic_error( "Document is already initialized" );
+    }
+    _source_name = file_name;
+    set<string> tags;
+    for ( const auto& et : _lazy_types ){
+      tags.insert( toString( et ) );
+    }
+    try {
+      _mapped = new binary::MappedSource( file_name, tags );
+      _xmldoc = _mapped->skeleton();
+    }
+    catch ( const binary::BinaryFormatError& e ){
+      delete _mapped;
+      _mapped = 0;
+      throw DocumentError( file_name, e.what() );
+    }
+    try {
+      TrustedParse trusted( this );
+      foliadoc = parseXml();
+    }
+    catch ( ... ){
+      xmlFreeDoc( _xmldoc );
+      _xmldoc = 0;
+      throw;
+    }
+    xmlFreeDoc( _xmldoc );
+    _xmldoc = 0;
+    return foliadoc != 0;
+  }
+
+} // namespace folia
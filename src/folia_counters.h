@@ -0,0 +1,55 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of libfolia
+
+  libfolia is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  libfolia is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at) science.ru.nl
+*/
+
+#ifndef FOLIA_COUNTERS_H
+#define FOLIA_COUNTERS_H
+
+#include "libfolia/folia_metrics.h"
+
+// the instrumentation macros of the library. They are compiled out when
+// the library is configured with --disable-metrics
+
+#ifdef FOLIA_NO_METRICS
+#define FOLIA_COUNT_M( m, c, n ) do {} while ( false )
+#define FOLIA_COUNT( doc, c, n ) do {} while ( false )
+#else
+  /// add n to Counter c of Metrics m, when not 0
+#define FOLIA_COUNT_M( m, c, n )					\
+  do {									\
+    if ( (m) ){								\
+      (m)->count( (c), (n) );						\
+    }									\
+  } while ( false )
+  /// add n to Counter c of the Metrics of Document doc, when it has them
+#define FOLIA_COUNT( doc, c, n )					\
+  do {									\
+    if ( (doc) ){							\
+      FOLIA_COUNT_M( (doc)->metrics(), c, n );				\
+    }									\
+  } while ( false )
+#endif
+
+#endif // FOLIA_COUNTERS_H
@@ -32,6 +32,9 @@
 #include <vector>
 #include <map>
 #include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <exception>
 #include "config.h"
 #include "ticcutils/PrettyPrint.h"
 #include "ticcutils/XMLtools.h"
@@ -40,6 +43,8 @@
 #include "ticcutils/zipper.h"
 #include "libfolia/folia.h"
 #include "libfolia/folia_properties.h"
+#include "libfolia/folia_binary.h"
+#include "folia_counters.h"
 #include "libxml/xmlstring.h"
 
 using namespace std;
@@ -57,9 +62,70 @@ static TiCC::LogStream DBG_CERR(cerr,NoStamp);
 namespace folia {
   using TiCC::operator<<;
   /// define a static default LogStream
-  TiCC::LogStream DBG_CERR(cerr,NoStamp);
+  TiCC::LogStream DBG_CERR(cerr,"folia:",NoStamp);
   /// connect to the default
   TiCC::LogStream *_dbg_file = &DBG_CERR;
+
+  class Document::ParseJob {
+    /// a subtree that is parsed on a worker thread.
+    /*!
+      While the workers run, the Document is read-only. All registrations
+      that would normally go into the Document are collected here, and
+      merged in document order afterwards.
+    */
+  public:
+    ParseJob( const Document *doc, AbstractElement *el, const xmlNode *node ):
+      _doc( doc ),
+      el( el ),
+      node( node ),
+      warnings( 0 ),
+      fallback( false ),
+      done( false )
+    {};
+    const Document *_doc;
+    AbstractElement *el;    ///< the element which children are parsed
+    const xmlNode *node;    ///< the xml node holding those children
+    map<string,FoliaElement*> ids; ///< the local part of the id index
+    vector<TextContent*> t_buffer; ///< the local offset validation buffers
+    vector<PhonContent*> p_buffer;
+    set<string> textclasses;
+    map<AnnotationType,map<string,int>> refs; ///< annotation refcount deltas
+    vector<FoliaElement*> kept;
+    int warnings;
+    bool fallback; ///< the subtree must be parsed again, sequentially
+    bool done;     ///< the worker has run
+    exception_ptr error;
+  };
+
+  thread_local Document::ParseJob *Document::_current_job = 0;
+
+  /// the comment that replaces the body in Document::save_prologue()
+  const string body_marker = "folia-body-goes-here";
+
+  struct ParallelFallback {
+    /// thrown to abort a worker that needs shared state. Deliberately not a
+    /// std::exception, so it passes all handlers in the parser.
+  };
+
+  unique_lock<recursive_mutex> Document::shared_guard() const {
+    /// lock the registries of the Document, when concurrent updates are on
+    /*!
+      \return a lock that is released when it goes out of scope. When
+      concurrent_updates() is false, it doesn't hold anything
+    */
+    if ( _concurrent_updates ){
+      return unique_lock<recursive_mutex>( _shared_mutex );
+    }
+    return unique_lock<recursive_mutex>();
+  }
+
+  Document::ParseJob *Document::worker_job() const {
+    /// return the ParseJob this thread is working on for this Document
+    if ( _current_job && _current_job->_doc == this ){
+      return _current_job;
+    }
+    return 0;
+  }
   ostream& operator<<( ostream& os,
 		       const Document::annotation_info& at ){
     /// output an annotation_info structure (Debugging only)
@@ -201,7 +267,7 @@ namespace folia {
       \param kwargs a list of key-value pairs
 
       this function initializes a Document and can set the attributes
-      \e 'debug' and \e 'mode'
+      \e 'debug', \e 'mode' and \e 'threads'
 
       When the attributes \e 'file' or \e 'string' are found, the value is used
       to extract a complete FoLiA document from that file or string.
@@ -216,6 +282,14 @@ namespace folia {
     if ( !value.empty() ){
       setmode( value );
     }
+    value = args.extract( "threads" );
+    if ( !value.empty() ){
+      set_parse_threads( TiCC::stringTo<unsigned int>( value ) );
+    }
+    value = args.extract( "metrics" );
+    if ( !value.empty() ){
+      enable_metrics( TiCC::stringTo<bool>( value ) );
+    }
     if ( args.empty() ){
       return;
     }
@@ -317,18 +391,22 @@ namespace folia {
     foliadoc = 0;
     _foliaNsIn_href = 0;
     _foliaNsIn_prefix = 0;
-    _foliaNsOut = 0;
     debug = DEBUG_FLAGS::NODEBUG;
     mode = DocMode( DocMode::CHECKTEXT|DocMode::AUTODECLARE );
     _external_document = false;
     _incremental_parse = false;
-    _preserve_spaces = false;
+    _trusted_input = false;
+    _mapped = 0;
+    _lazy_types = { ElementType::Division_t, ElementType::Paragraph_t };
+    _parse_jobs = 0;
+    _parse_threads = 1;
+    _concurrent_updates = false;
+    _declarations_frozen = false;
+    _metrics = 0;
     _warn_count = 0;
     _major_version = 0;
     _minor_version = 0;
     _sub_version = 0;
-    _dbg_file = 0;
-    DBG_CERR.set_message("folia:");
   }
 
   Document::~Document(){
@@ -357,6 +435,9 @@ namespace folia {
       delete val;
     }
     delete _provenance;
+    // deferred subtrees refer to the mapping, so this goes last
+    delete _mapped;
+    delete _metrics;
   }
 
   void Document::setmode( const string& ms ) const {
@@ -372,6 +453,7 @@ namespace folia {
       '(no)checktext' (default is checktext),
       '(no)fixtext' (default is NO),
       '(no)autodeclare' (default is NO)
+      '(no)lazy' (default is NO)
 
       example:
 
@@ -421,6 +503,12 @@ namespace folia {
       else if ( mod == "noexplicit" ){
 	mode = mode & ~DocMode::EXPLICIT;
       }
+      else if ( mod == "lazy" ){
+	mode = mode | DocMode::LAZY;
+      }
+      else if ( mod == "nolazy" ){
+	mode = mode & ~DocMode::LAZY;
+      }
       else {
 	throw invalid_argument( "FoLiA::Document: unsupported mode value: "+ mod );
       }
@@ -464,6 +552,9 @@ namespace folia {
     if ( mode % DocMode::EXPLICIT ){
       result += "explicit,";
     }
+    if ( mode % DocMode::LAZY ){
+      result += "lazy,";
+    }
     return result;
   }
 
@@ -580,6 +671,65 @@ namespace folia {
     return old_val;
   }
 
+  bool Document::set_lazy( bool new_val ) const{
+    /// sets the 'lazy' mode to on/off
+    /*!
+      \param new_val the boolean to use for on/off
+      \return the previous value
+
+      In lazy mode, the children of elements with a type in lazy_types()
+      are parsed on first access. This must be set before reading.
+    */
+    bool old_val = (mode % DocMode::LAZY);
+    if ( new_val ){
+      mode = mode | DocMode::LAZY;
+    }
+    else {
+      mode = mode & ~DocMode::LAZY;
+    }
+    return old_val;
+  }
+
+  void Document::set_parse_threads( unsigned int n ){
+    /// set the number of threads used to parse a Document
+    /*!
+      \param n the number of threads. 0 means: use all available cores.
+
+      When n > 1, the children of the elements with a type in lazy_types()
+      are parsed on worker threads, and merged into the Document in
+      document order afterwards. This is not done in LAZY mode, for memory
+      mapped Documents, or when FIXTEXT is set. Must be set before reading.
+    */
+    if ( n == 0 ){
+      n = std::thread::hardware_concurrency();
+    }
+    _parse_threads = std::max( n, 1u );
+  }
+
+  void Document::enable_metrics( bool on ){
+    /// start or stop collecting the time spent in the phases of parsing
+    /// and output
+    /*!
+      \param on when true, start collecting from now on. Otherwise stop
+      collecting and discard the results
+      throws when the library is built without metrics support, because
+      the counters would silently stay 0
+    */
+    if ( on ){
+#ifdef FOLIA_NO_METRICS
+      throw runtime_error( "enable_metrics(): libfolia was built with "
+			   "--disable-metrics" );
+#endif
+      if ( !_metrics ){
+	_metrics = new Metrics();
+      }
+    }
+    else {
+      delete _metrics;
+      _metrics = 0;
+    }
+  }
+
   void Document::set_dbg_stream( TiCC::LogStream *ls ){
     /// switch debugging to another LogStream
     if ( _dbg_file
@@ -596,10 +746,21 @@ namespace folia {
       \param el the FoliaElement to add
       will throw when \em el->id() is already in the index
      */
+    auto guard = shared_guard();
     const string my_id = el->id();
     if ( my_id.empty() ) {
       return;
     }
+    FOLIA_COUNT_M( _metrics, Counter::INDEX_LOOKUPS, 1 );
+    ParseJob *job = worker_job();
+    if ( job ){
+      // the global index is read-only while the workers run
+      if ( sindex.find( my_id ) != sindex.end()
+	   || !job->ids.emplace( my_id, el ).second ){
+	throw DuplicateIDError( my_id );
+      }
+      return;
+    }
     auto it = sindex.find( my_id );
     if ( it == sindex.end() ){
       sindex[my_id] = el;
@@ -614,6 +775,7 @@ namespace folia {
     /*!
       \param id The id to remove
     */
+    auto guard = shared_guard();
     if ( sindex.empty() ){
       // only when ~Document is in progress
       return;
@@ -621,9 +783,105 @@ namespace folia {
     if ( id.empty() ) {
       return;
     }
+    ParseJob *job = worker_job();
+    if ( job ){
+      job->ids.erase( id );
+      return;
+    }
     sindex.erase(id);
   }
 
+  void Document::keepForDeletion( FoliaElement *p ) {
+    /// add FoliaElement \e p to the delSet
+    /*!
+      \param p the FoliaElement to keep for later annihilation
+      the delSet is kept until the destruction of the Document
+    */
+    auto guard = shared_guard();
+    ParseJob *job = worker_job();
+    if ( job ){
+      job->kept.push_back( p );
+      return;
+    }
+    delSet.insert( p );
+  }
+
+  void Document::addExternal( External *p ) {
+    /// add a node to the _externals list
+    /*!
+      \param p The node to add
+    */
+    auto guard = shared_guard();
+    if ( worker_job() ){
+      worker_job()->fallback = true;
+      throw ParallelFallback();
+    }
+    _externals.push_back( p );
+  }
+
+  void Document::cache_textcontent( TextContent *tc ){
+    /// add a TextContent to the validation buffer
+    /*!
+      \param tc the TextContent to add to the buffer
+      on a call to validate_offsets() this buffer is used to validate
+      all offsets.
+    */
+    auto guard = shared_guard();
+    ParseJob *job = worker_job();
+    if ( job ){
+      job->t_buffer.push_back( tc );
+      return;
+    }
+    t_offset_validation_buffer.push_back( tc );
+  }
+
+  void Document::cache_phoncontent( PhonContent *pc ){
+    /// add a PhonContent to the validation buffer
+    /*!
+      \param pc the PhonContent to add
+      on a call to validate_offsets() this buffer is used to validate
+      all offsets.
+    */
+    auto guard = shared_guard();
+    ParseJob *job = worker_job();
+    if ( job ){
+      job->p_buffer.push_back( pc );
+      return;
+    }
+    p_offset_validation_buffer.push_back( pc );
+  }
+
+  void Document::increment_warn_count() const {
+    /// increment the warning count
+    // NOTE: function is defined const, but the _warn_count is mutable
+    ParseJob *job = worker_job();
+    if ( job ){
+      ++job->warnings;
+      return;
+    }
+    ++_warn_count;
+  }
+
+  void Document::add_textclass( const string& tc ){
+    /// register a textclass found in the document
+    auto guard = shared_guard();
+    ParseJob *job = worker_job();
+    if ( job ){
+      job->textclasses.insert( tc );
+      return;
+    }
+    _textclasses.insert( tc );
+  }
+
+  const set<string>& Document::textclasses() const {
+    /// return all textclasses found in the document (so far)
+    ParseJob *job = worker_job();
+    if ( job ){
+      return job->textclasses;
+    }
+    return _textclasses;
+  }
+
   string Document::annotation_type_to_string( AnnotationType ann ) const {
     /// return the ANNOTATIONTYPE translated to a string in a Document context.
     /// takes the version into account, for older labels
@@ -644,45 +902,6 @@ namespace folia {
     return result;
   }
 
-  static void error_sink(void *mydata, xmlError *error ){
-    /// helper function for libxml2 to catch and display problems in an
-    /// orderly fashion
-    /*!
-      \param a pointer to a struct to hold persistent data. In our case just an
-      int.
-      \param error an xmlEror structure created by a libxml2 function
-
-      For the first error encountered, a message is sent to stderr. Further
-      errors are just counted. It is up to calling functions to react on a
-      a count > 0
-     */
-    int *cnt = static_cast<int*>(mydata);
-    if ( *cnt == 0 ){
-      string line = "\n";
-      if ( error->file ){
-	line += string(error->file) + ":";
-	if ( error->line > 0 ){
-	  line += TiCC::toString(error->line) + ":";
-	}
-      }
-      line += " XML-error: " + string(error->message);
-      cerr << line;
-      if ( error->ctxt ){
-	xmlParserCtxt *ctx = static_cast<xmlParserCtxt*>(error->ctxt);
-	xmlBuffer *buffer = xmlBufferCreate();
-	int size = xmlNodeDump(buffer, ctx->myDoc, ctx->node, 0, 1 );
-	cerr << string( ctx->nodeNr*2, ' ') << buffer->content << endl;
-	xmlBufferFree( buffer );
-	if ( size >=0
-	     && error->int2 != 0 ){
-	  cerr << string( std::min(error->int2,size), ' ') << "^" << endl;
-	}
-      }
-    }
-    (*cnt)++;
-    return;
-  }
-
   bool Document::read_from_file( const string& file_name ){
     /// read a FoLiA document from a file
     /*!
@@ -704,14 +923,14 @@ namespace folia {
       string buffer = TiCC::bz2ReadFile( file_name );
       return read_from_string( buffer );
     }
-    int cnt = 0;
-    xmlSetStructuredErrorFunc( &cnt, (xmlStructuredErrorFunc)error_sink );
-    _xmldoc = xmlReadFile( file_name.c_str(),
-			   0,
-			   XML_PARSER_OPTIONS );
+    XmlParseContext parser;
+    {
+      PhaseTimer timer( _metrics, Phase::TOKENIZE );
+      _xmldoc = parser.read_file( file_name, XML_PARSER_OPTIONS );
+    }
     if ( _xmldoc ){
-      if ( cnt > 0 ){
-	throw DocumentError( file_name, "document is invalid" );
+      if ( parser.count() > 0 ){
+	throw XmlParseError( file_name, parser.diagnostics(), parser.count() );
       }
       if ( debug % DEBUG_FLAGS::PARSING ){
 	cout << "read a doc from " << file_name << endl;
@@ -729,13 +948,19 @@ namespace folia {
 	  cout << "failed to parse the doc from: " << file_name << endl;
 	}
       }
-      xmlFreeDoc( _xmldoc );
-      _xmldoc = 0;
+      if ( !lazy() ){
+	// in lazy mode, deferred subtrees still refer to the xml tree
+	xmlFreeDoc( _xmldoc );
+	_xmldoc = 0;
+      }
       return foliadoc != 0;
     }
     if ( debug % DEBUG_FLAGS::PARSING ){
       cout << "Failed to read a doc from " << file_name << endl;
     }
+    if ( parser.count() > 0 ){
+      throw XmlParseError( file_name, parser.diagnostics(), parser.count() );
+    }
     throw DocumentError( file_name, "No valid FoLiA read" );
   }
 
@@ -748,14 +973,16 @@ namespace folia {
     if ( foliadoc ){
       throw logic_error( "Document is already initialized" );
     }
-    int cnt = 0;
-    xmlSetStructuredErrorFunc( &cnt, (xmlStructuredErrorFunc)error_sink );
-    _xmldoc = xmlReadMemory( buffer.c_str(), buffer.length(), 0, 0,
-			     XML_PARSER_OPTIONS );
+    XmlParseContext parser;
+    {
+      PhaseTimer timer( _metrics, Phase::TOKENIZE );
+      _xmldoc = parser.read_memory( buffer, "", XML_PARSER_OPTIONS );
+    }
     if ( _xmldoc ){
       _source_name = "memory-buffer";
-      if ( cnt > 0 ){
-	throw DocumentError( _source_name, "document is invalid" );
+      if ( parser.count() > 0 ){
+	throw XmlParseError( _source_name, parser.diagnostics(),
+			     parser.count() );
       }
       if ( debug % DEBUG_FLAGS::PARSING ){
 	cout << "read a doc from string" << endl;
@@ -773,10 +1000,16 @@ namespace folia {
 	  cout << "failed to parse the doc" << endl;
 	}
       }
-      xmlFreeDoc( _xmldoc );
-      _xmldoc = 0;
+      if ( !lazy() ){
+	xmlFreeDoc( _xmldoc );
+	_xmldoc = 0;
+      }
       return foliadoc != 0;
     }
+    if ( parser.count() > 0 ){
+      throw XmlParseError( "memory-buffer", parser.diagnostics(),
+			   parser.count() );
+    }
     if ( debug % DEBUG_FLAGS::PARSING ){
       throw runtime_error( "Failed to read a doc from a string" );
     }
@@ -811,15 +1044,53 @@ namespace folia {
       FoLiA nodes in the default namespace.
       \param canonical determines to output in canonical order. Default is no.
     */
-    bool old_k = set_canonical(canonical);
-    os << toXml( ns_label );
+    os << to_xml_string( ns_label, canonical );
     // the toXml() string already ends with a newline (i hope....)
     // but flush the stream
     os.flush();
-    set_canonical(old_k);
     return os.good();
   }
 
+  string Document::save_prologue( ostream& os,
+				  const string& ns_label ) const {
+    /// output the Document upto and including the opening tag of the
+    /// \<text> or \<speech> node
+    /*!
+      \param os the output stream
+      \param ns_label the namespace name to use
+      \return the epilogue: the closing tags that follow the body
+
+      The body itself is never serialized, so the cost depends on the size
+      of the metadata only. The prologue is output without a final newline
+    */
+    PhaseTimer timer( _metrics, Phase::SERIALIZE );
+    if ( !foliadoc ){
+      throw runtime_error( "can't save, no doc" );
+    }
+    xmlDoc *outDoc = to_xmlDoc( ns_label, canonical(), false );
+    xmlChar *buf; int size;
+    xmlDocDumpFormatMemoryEnc( outDoc, &buf, &size,
+			       output_encoding, 1 );
+    string data = to_string( buf, size );
+    xmlFree( buf );
+    xmlFreeDoc( outDoc );
+    // the body comes last, so search backwards, avoiding any look-alike in
+    // the metadata
+    const string marker = "<!--" + body_marker + "-->";
+    string::size_type pos = data.rfind( marker );
+    if ( pos == string::npos ){
+      throw logic_error( "save_prologue(): no <text> or <speech> found" );
+    }
+    string::size_type head_end = data.find_last_not_of( " \n", pos-1 ) + 1;
+    os << data.substr( 0, head_end );
+    FOLIA_COUNT_M( _metrics, Counter::BYTES_SERIALIZED, head_end );
+    string epilogue = data.substr( pos + marker.size() );
+    if ( !epilogue.empty() && epilogue[0] == '\n' ){
+      epilogue.erase( 0, 1 );
+    }
+    return epilogue;
+  }
+
   bool Document::save( const string& file_name,
 		       const string& ns_label,
 		       bool canonical ) const {
@@ -833,15 +1104,13 @@ namespace folia {
       This function also takes care of output to files in .bz2 or .gz format
       when the right extension is given.
     */
-    bool old_k = set_canonical(canonical);
     bool result = false;
     try {
-      result = toXml( file_name, ns_label );
+      result = to_xml_file( file_name, ns_label, canonical );
     }
     catch ( const exception& e ){
       throw runtime_error( "saving to file " + file_name + " failed: " + e.what() );
     }
-    set_canonical( old_k );
     return result;
   }
 
@@ -851,16 +1120,15 @@ namespace folia {
       \param canonical determines to output in canonical order. Default is no.
       \return the complete document in an unformatted string
     */
-    bool old_k = set_canonical(canonical);
-    xmlDoc *outDoc = to_xmlDoc( "" );
-    set_canonical(old_k);
+    PhaseTimer timer( _metrics, Phase::SERIALIZE );
+    xmlDoc *outDoc = to_xmlDoc( "", canonical );
     xmlChar *buf; int size;
     xmlDocDumpFormatMemoryEnc( outDoc, &buf, &size,
 			       output_encoding, 0 ); // no formatting
     string result = to_string( buf, size );
     xmlFree( buf );
     xmlFreeDoc( outDoc );
-    _foliaNsOut = 0;
+    FOLIA_COUNT_M( _metrics, Counter::BYTES_SERIALIZED, result.size() );
     return result;
   }
 
@@ -870,7 +1138,50 @@ namespace folia {
       \param id the id we search
       \return the FoliaElement with this \e id or 0, when not present
      */
-    const auto& it = sindex.find( id );
+    auto guard = shared_guard();
+    FOLIA_COUNT_M( _metrics, Counter::INDEX_LOOKUPS, 1 );
+    ParseJob *job = worker_job();
+    if ( job ){
+      auto jit = job->ids.find( id );
+      if ( jit != job->ids.end() ){
+	return jit->second;
+      }
+      // the node lives outside this subtree. Resolving it here would
+      // mutate shared nodes (refcounts), so this subtree is parsed again
+      // in document order, after the merge.
+      job->fallback = true;
+      return 0;
+    }
+    auto it = sindex.find( id );
+    while ( it == sindex.end()
+	    && _mapped
+	    && _mapped->expand_for( id ) ){
+      // the node might live in a not yet parsed subtree
+      it = sindex.find( id );
+    }
+    while ( it == sindex.end()
+	    && !_deferred_ids.empty() ){
+      // the node might live in a not yet parsed subtree
+      auto dit = _deferred_ids.find( id );
+      if ( dit == _deferred_ids.end() ){
+	break;
+      }
+      dit->second->materialize();
+      it = sindex.find( id );
+    }
+    while ( it == sindex.end()
+	    && _parse_jobs ){
+      // still in the sequential part of a parallel parse. The node might
+      // live in a subtree that is waiting for a worker, so parse them now
+      auto pit = std::find_if( _parse_jobs->begin(), _parse_jobs->end(),
+			       []( const ParseJob& j ){
+				 return j.el->is_deferred(); } );
+      if ( pit == _parse_jobs->end() ){
+	break;
+      }
+      pit->el->materialize();
+      it = sindex.find( id );
+    }
     if ( it == sindex.end() ){
       return 0;
     }
@@ -1159,6 +1470,7 @@ namespace folia {
       \param pid the processorID we look for
       \return the processor found, or 0
     */
+    auto guard = shared_guard();
     if ( _provenance ){
       return _provenance->get_processor_by_id( pid );
     }
@@ -1963,18 +2275,22 @@ namespace folia {
     }
   }
 
-  bool Document::validate_offsets() const {
+  bool Document::validate_offsets( size_t t_from, size_t p_from ) const {
     /// Validate all the offset values as found in all \<t\> and \<ph\> nodes
     /*!
+      \param t_from the first entry of the \<t\> buffer to check
+      \param p_from the first entry of the \<ph\> buffer to check
+
       During Document parsing, \<t\> and \<ph\> nodes are stored in a buffer
       until the whole parsing is done.
 
       Then we are able to examine those nodes in their context and check the
       offsets used.
      */
+    PhaseTimer timer( _metrics, Phase::TEXT_CHECKS );
     set<TextContent*> t_done;
     int cumulated_offset = 0;
-    for ( auto txt_it=t_offset_validation_buffer.begin();
+    for ( auto txt_it=t_offset_validation_buffer.begin() + t_from;
 	  txt_it != t_offset_validation_buffer.end();
 	  ++txt_it ){
       TextContent *txt = *txt_it;
@@ -2022,7 +2338,10 @@ namespace folia {
     }
     set<PhonContent*> p_done;
     cumulated_offset = 0;
-    for ( const auto& phon : p_offset_validation_buffer ){
+    for ( auto ph_it=p_offset_validation_buffer.begin() + p_from;
+	  ph_it != p_offset_validation_buffer.end();
+	  ++ph_it ){
+      PhonContent *phon = *ph_it;
       if ( p_done.find( phon ) != p_done.end() ){
 	continue;
       }
@@ -2068,11 +2387,324 @@ namespace folia {
     return true;
   }
 
+  class Document::XmlSubtree: public DeferredSubtree {
+    /// the children of an element, kept in the xml tree of a LAZY Document
+  public:
+    XmlSubtree( Document *, AbstractElement *, const xmlNode *, bool = true );
+    ~XmlSubtree() override;
+    void expand( AbstractElement * ) override;
+  private:
+    Document *_doc;
+    AbstractElement *_owner;
+    const xmlNode *_node;
+    vector<string> _ids;
+  };
+
+  Document::XmlSubtree::XmlSubtree( Document *doc,
+				    AbstractElement *owner,
+				    const xmlNode *node,
+				    bool register_ids ):
+    _doc( doc ),
+    _owner( owner ),
+    _node( node )
+  {
+    /// register the ids in the subtree, so Document::index() can find them
+    if ( !register_ids ){
+      // a parallel parse handles its missing ids itself
+      return;
+    }
+    vector<const xmlNode*> stack( 1, node->children );
+    while ( !stack.empty() ){
+      const xmlNode *p = stack.back();
+      stack.pop_back();
+      for ( ; p; p = p->next ){
+	if ( p->type != XML_ELEMENT_NODE ){
+	  continue;
+	}
+	xmlChar *id = xmlGetNsProp( p,
+				    reinterpret_cast<const xmlChar*>("id"),
+				    XML_XML_NAMESPACE );
+	if ( id ){
+	  _ids.push_back( reinterpret_cast<const char*>(id) );
+	  _doc->_deferred_ids[_ids.back()] = _owner;
+	  xmlFree( id );
+	}
+	if ( p->children ){
+	  stack.push_back( p->children );
+	}
+      }
+    }
+  }
+
+  Document::XmlSubtree::~XmlSubtree(){
+    for ( const auto& id : _ids ){
+      auto it = _doc->_deferred_ids.find( id );
+      if ( it != _doc->_deferred_ids.end()
+	   && it->second == _owner ){
+	_doc->_deferred_ids.erase( it );
+      }
+    }
+  }
+
+  void Document::XmlSubtree::expand( AbstractElement *el ){
+    /// parse the children, and perform the checks we postponed
+    if ( _doc->worker_job() ){
+      // on a worker thread. The bookkeeping is done when merging
+      el->parse_children( _node );
+      return;
+    }
+    size_t t_from = _doc->t_offset_validation_buffer.size();
+    size_t p_from = _doc->p_offset_validation_buffer.size();
+    if ( _doc->debug % DEBUG_FLAGS::PARSING ){
+      DBG << "expanding deferred " << el->xmltag() << " id=" << el->id()
+	  << endl;
+    }
+    el->parse_children( _node );
+    _doc->expanded( el, t_from, p_from );
+  }
+
+  void Document::expand_all(){
+    /// parse all deferred subtrees of a LAZY or memory mapped Document
+    /*!
+      After this, reading the Document doesn't modify it anymore, so it can
+      be shared between threads.
+    */
+    if ( !foliadoc ){
+      return;
+    }
+    vector<FoliaElement*> stack( 1, foliadoc );
+    while ( !stack.empty() ){
+      FoliaElement *el = stack.back();
+      stack.pop_back();
+      for ( const auto& child : el->data() ){
+	stack.push_back( child );
+      }
+    }
+  }
+
+  bool Document::defer_subtree( AbstractElement *el, const xmlNode *node ){
+    /// decide if the children of el should be parsed later
+    /*!
+      \param el the element being parsed
+      \param node the xmlNode with the children of el
+      \return true when the children are deferred
+
+      This is the case for Documents that are memory mapped, or are parsed
+      in LAZY mode or on multiple threads, when el has a type in lazy_types()
+    */
+    if ( _mapped ){
+      return _mapped->defer( el, node );
+    }
+    if ( lazy()
+	 && !_incremental_parse
+	 && node->children
+	 && _lazy_types.find( el->element_id() ) != _lazy_types.end() ){
+      el->set_deferred( new XmlSubtree( this, el, node ) );
+      return true;
+    }
+    if ( _parse_jobs
+	 && !worker_job()
+	 && node->children
+	 && _lazy_types.find( el->element_id() ) != _lazy_types.end() ){
+      el->set_deferred( new XmlSubtree( this, el, node, false ) );
+      _parse_jobs->emplace_back( this, el, node );
+      return true;
+    }
+    return false;
+  }
+
+  bool Document::postpone_checks( const AbstractElement *el ){
+    /// should the checks after parsing el wait for deferred children?
+    /*!
+      \param el a just parsed element
+      \return true when some children of el are not parsed yet. The checks
+      are performed when the last of them is expanded.
+    */
+    if ( !( lazy() || _parse_jobs )
+	 || _mapped
+	 || worker_job() ){
+      return false;
+    }
+    size_t pending = 0;
+    for ( const auto& child : el->data() ){
+      const AbstractElement *ae = dynamic_cast<const AbstractElement*>(child);
+      if ( ae && ae->is_deferred() ){
+	++pending;
+      }
+      else {
+	auto it = _postponed.find( child );
+	if ( it != _postponed.end() ){
+	  pending += it->second;
+	}
+      }
+    }
+    if ( pending == 0 ){
+      return false;
+    }
+    _postponed[el] = pending;
+    return true;
+  }
+
+  void Document::expanded( AbstractElement *el, size_t t_from, size_t p_from ){
+    /// bookkeeping after expanding a deferred subtree of el
+    /*!
+      \param el the expanded element
+      \param t_from the start of the new entries in the \<t\> buffer
+      \param p_from the start of the new entries in the \<ph\> buffer
+
+      validates the offsets in the new subtree and runs the postponed checks
+      of the ancestors that have no deferred subtrees left.
+    */
+    validate_offsets( t_from, p_from );
+    release_postponed( el );
+  }
+
+  void Document::release_postponed( AbstractElement *el ){
+    /// run the postponed checks of the ancestors of a completed subtree
+    /*!
+      \param el the element which children are now all parsed
+    */
+    size_t left = 0;
+    auto it = _postponed.find( el );
+    if ( it != _postponed.end() ){
+      left = it->second;
+    }
+    for ( FoliaElement *anc = el->parent(); anc; anc = anc->parent() ){
+      it = _postponed.find( anc );
+      if ( it == _postponed.end() ){
+	continue;
+      }
+      it->second += left;
+      if ( --(it->second) == 0 ){
+	_postponed.erase( it );
+	AbstractElement *ae = dynamic_cast<AbstractElement*>(anc);
+	if ( ae ){
+	  ae->check_after_parsing();
+	}
+      }
+    }
+  }
+
+  void Document::run_parse_jobs(){
+    /// parse the deferred subtrees of a parallel parse on worker threads
+    /*!
+      The workers only touch their own subtree and ParseJob. When they are
+      all done, the results are merged in document order, so the outcome
+      does not depend on the scheduling.
+    */
+    vector<ParseJob*> todo;
+    for ( auto& job : *_parse_jobs ){
+      if ( job.el->is_deferred() ){
+	// not already expanded on demand in the sequential part
+	todo.push_back( &job );
+      }
+    }
+    std::atomic<size_t> next( 0 );
+    auto worker = [&](){
+      size_t i;
+      while ( ( i = next++ ) < todo.size() ){
+	ParseJob *job = todo[i];
+	PhaseTimer timer( _metrics, Phase::BUILD );
+	job->textclasses = _textclasses;
+	_current_job = job;
+	try {
+	  job->el->materialize();
+	}
+	catch ( const ParallelFallback& ){
+	  job->fallback = true;
+	}
+	catch ( ... ){
+	  job->error = std::current_exception();
+	}
+	_current_job = 0;
+	job->done = true;
+      }
+    };
+    size_t n_threads = std::min<size_t>( _parse_threads, todo.size() );
+    if ( debug % DEBUG_FLAGS::PARSING ){
+      DBG << "parsing " << todo.size() << " subtrees on " << n_threads
+	  << " threads" << endl;
+    }
+    vector<std::thread> threads;
+    for ( size_t i=1; i < n_threads; ++i ){
+      threads.emplace_back( worker );
+    }
+    worker();
+    for ( auto& t : threads ){
+      t.join();
+    }
+    // from here on, parse sequentially again
+    vector<ParseJob>& jobs = *_parse_jobs;
+    _parse_jobs = 0;
+    for ( auto& job : jobs ){
+      if ( job.done ){
+	merge_parse_job( job );
+      }
+    }
+  }
+
+  void Document::merge_parse_job( ParseJob& job ){
+    /// add the results of a worker to the Document
+    /*!
+      \param job the ParseJob to merge.
+      When the worker needed shared state, its partial result is discarded,
+      and the subtree is parsed again, now in document order.
+    */
+    delSet.insert( job.kept.begin(), job.kept.end() );
+    job.kept.clear();
+    if ( job.fallback ){
+      if ( debug % DEBUG_FLAGS::PARSING ){
+	DBG << "sequential parse of " << job.el->xmltag()
+	    << " id=" << job.el->id() << endl;
+      }
+      // clean up, still routing all registrations to the job
+      _current_job = &job;
+      vector<FoliaElement*> kids = job.el->data();
+      for ( const auto& kid : kids ){
+	kid->destroy();
+      }
+      kids = job.el->data();
+      for ( const auto& kid : kids ){
+	// still referenced, so kept for deletion
+	job.el->remove( kid );
+      }
+      _current_job = 0;
+      delSet.insert( job.kept.begin(), job.kept.end() );
+      job.el->parse_children( job.node );
+    }
+    else if ( job.error ){
+      std::rethrow_exception( job.error );
+    }
+    else {
+      for ( const auto& [id,el] : job.ids ){
+	if ( !sindex.emplace( id, el ).second ){
+	  throw DuplicateIDError( id );
+	}
+      }
+      t_offset_validation_buffer.insert( t_offset_validation_buffer.end(),
+					 job.t_buffer.begin(),
+					 job.t_buffer.end() );
+      p_offset_validation_buffer.insert( p_offset_validation_buffer.end(),
+					 job.p_buffer.begin(),
+					 job.p_buffer.end() );
+      _textclasses.insert( job.textclasses.begin(), job.textclasses.end() );
+      for ( const auto& [type,sets] : job.refs ){
+	for ( const auto& [st,delta] : sets ){
+	  int& cnt = _annotationrefs[type][st];
+	  cnt = std::max( 0, cnt + delta );
+	}
+      }
+      _warn_count += job.warnings;
+    }
+    release_postponed( job.el );
+  }
+
   FoliaElement* Document::parseXml( ){
     /// parse a complete FoLiA tree from the XmlTree we have got in _xmldoc
     /*!
       \return an FoLiA element node, whicht is the root of the FoLiA Document
     */
+    PhaseTimer timer( _metrics, Phase::BUILD );
     parse_styles();
     xmlNode *root = xmlDocGetRootElement( _xmldoc );
     if ( root->ns ){
@@ -2110,9 +2742,27 @@ namespace folia {
 			       "Folia Document should have namespace declaration "
 			       + NSFOLIA + " but found: " + ns );
 	}
+	vector<ParseJob> jobs;
+	if ( _parse_threads > 1
+	     && !lazy()
+	     && !fixtext()
+	     && !_mapped
+	     && !_incremental_parse ){
+	  _parse_jobs = &jobs;
+	}
 	try {
 	  FoLiA *folia = new FoLiA( this );
-	  result = folia->parseXml( root );
+	  try {
+	    result = folia->parseXml( root );
+	    if ( _parse_jobs ){
+	      run_parse_jobs();
+	    }
+	  }
+	  catch ( ... ){
+	    _parse_jobs = 0;
+	    throw;
+	  }
+	  _parse_jobs = 0;
 	  resolveExternals();
 	}
 	catch ( const InconsistentText& e ){
@@ -2189,6 +2839,11 @@ namespace folia {
       \param setname The Set name to add
       \param _args an attribute-value list with additional parameters
     */
+    if ( worker_job() ){
+      // declarations are shared. Handle this subtree sequentially
+      worker_job()->fallback = true;
+      throw ParallelFallback();
+    }
     KWargs args = _args;
     if ( debug % DEBUG_FLAGS::DECLARATIONS ){
       DBG << "declare( " << folia::toString(type) << "," << setname << ", ["
@@ -2252,6 +2907,7 @@ namespace folia {
       \return the setname belonging to alias for this type, or alias if not
       found
     */
+    auto guard = shared_guard();
     const auto& ti = _alias_set.find(type);
     if ( ti != _alias_set.end() ){
       const auto& sti = ti->second.find( my_alias );
@@ -2271,6 +2927,7 @@ namespace folia {
       \return the alias belonging setname for this type, or setname if
       not found
      */
+    auto guard = shared_guard();
     const auto& ti = _set_alias.find(type);
     if ( ti != _set_alias.end() ){
       const auto& ali = ti->second.find( setname );
@@ -2367,6 +3024,7 @@ namespace folia {
       \param _processors a set of processor id's to relate to this declaration
       \param _alias an alias value for the setname
     */
+    auto guard = shared_guard();
     if ( debug % DEBUG_FLAGS::DECLARATIONS ){
       DBG << "internal_declare( " << folia::toString(type) << "," << setname
 	   << ", format=" << format << "," << annotator << ","
@@ -2446,6 +3104,11 @@ namespace folia {
       if ( debug % DEBUG_FLAGS::DECLARATIONS ){
 	DBG << "NO declaration exists for: " << type << ":" << setname << endl;
       }
+      if ( _declarations_frozen ){
+	throw DeclarationError( "the declarations are already output, unable to add one for "
+				+ folia::toString(type) + "-annotation ("
+				+ setname + ")" );
+      }
       string date = date_time;
       if ( date == "now()" ){
 	date = get_ISO_date();
@@ -2478,6 +3141,11 @@ namespace folia {
 
       When \em set_name is "", ALL declarations of \em type are deleted
      */
+    auto guard = shared_guard();
+    if ( worker_job() ){
+      worker_job()->fallback = true;
+      throw ParallelFallback();
+    }
     string setname = unalias(type,set_name);
     if ( debug % DEBUG_FLAGS::DECLARATIONS ){
       DBG << "undeclare: " << folia::toString(type) << "(" << set_name << "."
@@ -2647,11 +3315,17 @@ namespace folia {
       \param type the AnnotationType
       \param s the setname
     */
+    auto guard = shared_guard();
     if ( type != AnnotationType::NO_ANN ){
       string st = s;
       if ( st.empty() ){
 	st = default_set(type);
       }
+      ParseJob *job = worker_job();
+      if ( job ){
+	++job->refs[type][st];
+	return;
+      }
       ++_annotationrefs[type][st];
       // DBG << "increment " << toString(type) << "(" << st << ") to: "
       // 	   << _annotationrefs[type][s] << endl;
@@ -2665,6 +3339,14 @@ namespace folia {
       \param type the AnnotationType
       \param s the setname
     */
+    auto guard = shared_guard();
+    ParseJob *job = worker_job();
+    if ( job ){
+      if ( type != AnnotationType::NO_ANN ){
+	--job->refs[type][s];
+      }
+      return;
+    }
     if ( type != AnnotationType::NO_ANN
 	 && _annotationrefs[type][s] > 0 ){
       --_annotationrefs[type][s];
@@ -2688,6 +3370,9 @@ namespace folia {
       exists
 
     */
+    auto guard = shared_guard();
+    PhaseTimer timer( _metrics, Phase::DECLARATIONS );
+    FOLIA_COUNT_M( _metrics, Counter::DECLARATION_CHECKS, 1 );
     if ( debug % DEBUG_FLAGS::DECLARATIONS ){
       DBG << "declared(" << folia::toString(type) << ",'"
 	   << set_name << "')" << endl;
@@ -2752,8 +3437,13 @@ namespace folia {
       If set_name is empty ("") a match is found when a declarion for \em type
       exists
     */
-    AnnotationType at = element_annotation_map[et];
-    return declared( at, set_name );
+    auto guard = shared_guard();
+    PhaseTimer timer( _metrics, Phase::DECLARATIONS );
+    auto it = element_annotation_map.find( et );
+    if ( it == element_annotation_map.end() ){
+      return declared( AnnotationType::NO_ANN, set_name );
+    }
+    return declared( it->second, set_name );
   }
 
   string Document::default_set( AnnotationType type ) const {
@@ -2763,6 +3453,7 @@ namespace folia {
       \return the setname. May be empty ("") when there is none defined OR it
       is ambiguous.
     */
+    auto guard = shared_guard();
     if ( type == AnnotationType::NO_ANN ){
       return "";
     }
@@ -2799,6 +3490,7 @@ namespace folia {
       \return the annotator. May be empty ("") when there is none defined OR it
       is ambiguous.
     */
+    auto guard = shared_guard();
     if ( type == AnnotationType::NO_ANN ){
       return "";
     }
@@ -2820,6 +3512,7 @@ namespace folia {
       \return the annotator. May be empty ("") when there is none defined OR it
       is ambiguous.
     */
+    auto guard = shared_guard();
     if ( debug % DEBUG_FLAGS::ANNOTATIONS ){
       DBG << "annotationdefaults= " <<  _annotationdefaults << endl;
       DBG << "lookup: " << folia::toString(type) << endl;
@@ -2845,6 +3538,7 @@ namespace folia {
       \return the datetime value. May be empty ("") when there is none defined
       OR it is ambiguous.
     */
+    auto guard = shared_guard();
     string result;
     const auto* cur = lookup_default( type, setname );
     if ( cur != 0 ){
@@ -2863,6 +3557,7 @@ namespace folia {
       \return the processor. May be empty ("") when there is none defined OR it
       is ambiguous.
     */
+    auto guard = shared_guard();
     if ( debug % DEBUG_FLAGS::ANNOTATIONS ){
       DBG << "defaultprocessor(" << toString( type ) << ","
 	   << setname << ")" << endl;
@@ -2897,6 +3592,7 @@ namespace folia {
       of an AnnotationType undefined. With this function, we still are able to
       find the original value and use that e.g. on output.
     */
+    auto guard = shared_guard();
     auto const& it = _orig_ann_default_sets.find(type);
     if ( it == _orig_ann_default_sets.end() ){
       return "";
@@ -2918,6 +3614,7 @@ namespace folia {
       processor of an AnnotationType undefined. With this function, we still
       are able to find the original value and use that e.g. on output.
     */
+    auto guard = shared_guard();
     auto const& it = _orig_ann_default_procs.find(type);
     if ( it == _orig_ann_default_procs.end() ){
       return "";
@@ -2935,6 +3632,7 @@ namespace folia {
       \param setname the annotation set. An empty string ("") means ANY set.
       \return a list of annotators.
     */
+    auto guard = shared_guard();
     auto const cur = lookup_default( type, setname );
     vector<string> result;
     std::copy( cur->_processors.cbegin(),
@@ -2952,6 +3650,7 @@ namespace folia {
       \param setname the annotation set. An empty string ("") means ANY set.
       \return a list of processors.
     */
+    auto guard = shared_guard();
     vector<const processor*> result;
     if ( debug % DEBUG_FLAGS::PROVENANCE ){
       DBG << "getprocessors(" << toString( type ) << ","
@@ -3039,10 +3738,11 @@ namespace folia {
     }
   }
 
-  void Document::add_annotations( xmlNode *metadata ) const {
+  void Document::add_annotations( xmlNode *metadata, bool kanon ) const {
     /// create an annotations block under the xmlNode metadata
     /*!
       \param metadata the parent to add to
+      \param kanon output the declarations in canonical order
       calls add_one_anno() for every annotation declaration.
     */
     if ( debug % (DEBUG_FLAGS::ANNOTATIONS|DEBUG_FLAGS::SERIALIZE) ){
@@ -3052,7 +3752,7 @@ namespace folia {
     xmlNode *node = xmlAddChild( metadata,
 				 TiCC::XmlNewNode( foliaNs(),
 						   "annotations" ) );
-    if ( canonical() ){
+    if ( kanon ){
       // _anno_sort contains type:setname pair ordered on appearance
       multimap<AnnotationType,
 	       pair<AnnotationType,string>> ordered;
@@ -3268,11 +3968,53 @@ namespace folia {
     }
   }
 
-  xmlDoc *Document::to_xmlDoc( const string& ns_label ) const {
+  xmlNs *Document::foliaNs() const {
+    /// return a pointer to the output namespace structure
+    /*!
+      \return the namespace of the serialization of this Document that is
+      running on this thread, or 0
+    */
+    if ( _output.doc == this ){
+      return _output.ns;
+    }
+    return 0;
+  }
+
+  void Document::set_preserve_spaces( bool b ) const {
+    /// set/unset the preserve_spaces flag of the running serialization
+    _output.preserve_spaces = b;
+  }
+
+  bool Document::preserve_spaces() const {
+    /// return the value of the preserve_spaces flag
+    return _output.preserve_spaces;
+  }
+
+  thread_local Document::output_state Document::_output;
+
+  xmlDoc *Document::to_xmlDoc( const string& ns_label,
+			       bool kanon,
+			       bool with_body ) const {
     /// convert the Document to an xmlDoc
     /*!
-      \param ns_label a namespace label to use. (default "")
+      \param ns_label a namespace label to use.
+      \param kanon output in canonical order
+      \param with_body when false, the children of the \<text> or \<speech>
+      node are replaced by a body_marker comment
+
+      All state of the serialization is kept per thread, so several threads
+      may serialize the same Document at the same time.
     */
+    struct output_guard {
+      output_state saved;
+      explicit output_guard( const Document *doc ): saved( _output ){
+	_output = output_state();
+	_output.doc = doc;
+      }
+      ~output_guard(){
+	_output = saved;
+      }
+    } guard( this );
     if ( debug % DEBUG_FLAGS::SERIALIZE ){
       DBG << "to_xmlDoc: start serializing" << endl;
     }
@@ -3280,7 +4022,7 @@ namespace folia {
     add_styles( outDoc );
     for ( const auto* pr: preludes ){
       xmlAddChild( reinterpret_cast<xmlNode*>(outDoc),
-		   pr->xml( true, canonical() ) );
+		   pr->xml( true, kanon ) );
     }
     xmlNode *root = xmlNewDocNode( outDoc,
 				   0,
@@ -3296,22 +4038,22 @@ namespace folia {
     xmlSetNs( root, xl );
     if ( _foliaNsIn_href == 0 ){
       if ( ns_label.empty() ){
-	_foliaNsOut = xmlNewNs( root,
-				to_xmlChar(NSFOLIA),
-				0 );
+	_output.ns = xmlNewNs( root,
+			       to_xmlChar(NSFOLIA),
+			       0 );
       }
       else {
-	_foliaNsOut = xmlNewNs( root,
-				to_xmlChar(NSFOLIA),
-				to_xmlChar(ns_label) );
+	_output.ns = xmlNewNs( root,
+			       to_xmlChar(NSFOLIA),
+			       to_xmlChar(ns_label) );
       }
     }
     else {
-      _foliaNsOut = xmlNewNs( root,
-			      _foliaNsIn_href,
-			      _foliaNsIn_prefix );
+      _output.ns = xmlNewNs( root,
+			     _foliaNsIn_href,
+			     _foliaNsIn_prefix );
     }
-    xmlSetNs( root, _foliaNsOut );
+    xmlSetNs( root, _output.ns );
     if ( debug % DEBUG_FLAGS::SERIALIZE ){
       DBG << "to_xmlDoc: added namespaces" << endl;
     }
@@ -3332,7 +4074,7 @@ namespace folia {
     }
     addAttributes( root, attribs, debug % DEBUG_FLAGS::SERIALIZE );
     xmlNode *md = xmlAddChild( root, TiCC::XmlNewNode( foliaNs(), "metadata" ) );
-    add_annotations( md );
+    add_annotations( md, kanon );
     add_provenance( md );
     add_metadata( md );
 
@@ -3341,7 +4083,15 @@ namespace folia {
     }
     for ( size_t i=0; i < foliadoc->size(); ++i ){
       const FoliaElement* el = foliadoc->index(i);
-      xmlAddChild( root, el->xml( true, canonical() ) );
+      if ( with_body
+	   || ( el->element_id() != ElementType::Text_t
+		&& el->element_id() != ElementType::Speech_t ) ){
+	xmlAddChild( root, el->xml( true, kanon ) );
+      }
+      else {
+	xmlNode *body = xmlAddChild( root, el->xml( false, kanon ) );
+	xmlAddChild( body, xmlNewComment( to_xmlChar(body_marker) ) );
+      }
     }
     if ( debug % DEBUG_FLAGS::SERIALIZE ){
       DBG << "to_xmlDoc: done" << endl;
@@ -3354,19 +4104,29 @@ namespace folia {
     /*!
       \param ns_label a namespace label to use. (default "")
     */
+    return to_xml_string( ns_label, canonical() );
+  }
+
+  string Document::to_xml_string( const string& ns_label, bool kanon ) const {
+    /// dump the Document to a string
+    /*!
+      \param ns_label a namespace label to use.
+      \param kanon output in canonical order
+    */
+    PhaseTimer timer( _metrics, Phase::SERIALIZE );
     string result;
     if ( foliadoc ){
       if ( debug % DEBUG_FLAGS::SERIALIZE ){
 	DBG << "save document in a string" << endl;
       }
-      xmlDoc *outDoc = to_xmlDoc( ns_label );
+      xmlDoc *outDoc = to_xmlDoc( ns_label, kanon );
       xmlChar *buf; int size;
       xmlDocDumpFormatMemoryEnc( outDoc, &buf, &size,
 				 output_encoding, 1 );
       result = to_string( buf, size );
       xmlFree( buf );
       xmlFreeDoc( outDoc );
-      _foliaNsOut = 0;
+      FOLIA_COUNT_M( _metrics, Counter::BYTES_SERIALIZED, result.size() );
     }
     else {
       throw runtime_error( "can't save, no doc" );
@@ -3386,6 +4146,21 @@ namespace folia {
       \return false on error, true otherwise
       automaticly detects .gz and .bz2 filenames and will handle accordingly
     */
+    return to_xml_file( file_name, ns_label, canonical() );
+  }
+
+  bool Document::to_xml_file( const string& file_name,
+			      const string& ns_label,
+			      bool kanon ) const {
+    /// write the Document to a file
+    /*!
+      \param file_name the name of the file to create
+      \param ns_label a namespace label to use.
+      \param kanon output in canonical order
+      \return false on error, true otherwise
+      automaticly detects .gz and .bz2 filenames and will handle accordingly
+    */
+    PhaseTimer timer( _metrics, Phase::SERIALIZE );
     if ( foliadoc ){
       if ( debug % DEBUG_FLAGS::SERIALIZE ){
 	DBG << "save document in file '" << file_name << "'" << endl;
@@ -3396,7 +4171,7 @@ namespace folia {
 	  DBG << "toXML(). Output type is .bz2" << endl;
 	}
 	string tmpname = file_name.substr( 0, file_name.length() - 3 ) + "tmp";
-	if ( toXml( tmpname, ns_label ) ){
+	if ( to_xml_file( tmpname, ns_label, kanon ) ){
 	  bool stat = TiCC::bz2Compress( tmpname, file_name );
 	  remove( tmpname.c_str() );
 	  if ( !stat ){
@@ -3405,7 +4180,7 @@ namespace folia {
 	}
       }
       else {
-	xmlDoc *outDoc = to_xmlDoc( ns_label );
+	xmlDoc *outDoc = to_xmlDoc( ns_label, kanon );
 	if ( TiCC::match_back( file_name, ".gz" ) ){
 	  if ( debug % DEBUG_FLAGS::SERIALIZE ){
 	    DBG << "toXML(). Output type is .gz" << endl;
@@ -3416,7 +4191,9 @@ namespace folia {
 				    outDoc,
 				    output_encoding, 1 );
 	xmlFreeDoc( outDoc );
-	_foliaNsOut = 0;
+	if ( res > 0 ){
+	  FOLIA_COUNT_M( _metrics, Counter::BYTES_SERIALIZED, res );
+	}
       }
       if ( res == -1 ){
 	if ( debug % DEBUG_FLAGS::SERIALIZE ){
@@ -29,15 +29,25 @@
 #include <fstream>
 #include <cstring>
 #include <cstdio>
+#include <cerrno>
 #include <string>
+#include <sstream>
 #include <stack>
+#include <deque>
 #include <stdexcept>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "ticcutils/PrettyPrint.h"
 #include "ticcutils/FileUtils.h"
 #include "ticcutils/XMLtools.h"
 #include "ticcutils/zipper.h"
 #include "libfolia/folia.h"
+#include "folia_raw_input.h"
 
 using namespace std;
 
@@ -116,13 +126,34 @@ namespace folia {
     _done(false),
     _header_done(false),
     _finished(false),
-    _debug(false)
+    _debug(false),
+    _flush_policy( FlushPolicy::NONE ),
+    _flush_limit(0),
+    _held_nodes(0),
+    _flushed_bytes(0),
+    _skip_scan(false),
+    _raw(0),
+    _read_count(0),
+    _match_depth(0),
+    _checkpoint_every(0),
+    _top_nodes(0),
+    _last_checkpoint(0),
+    _at_resume_node(false),
+    _scoped_refs(false)
   {
     DBG_CERR.set_message("folia-engine:");
   }
 
   Engine::~Engine(){
     /// destructor
+    if ( _skip_scan ){
+      destroy( _external_node );
+      drop_ancestors( 0 );
+    }
+    if ( _raw ){
+      destroy( _external_node );
+      delete _raw;
+    }
     xmlFreeTextReader( _reader );
     delete _out_doc;
     delete _os;
@@ -304,6 +335,227 @@ namespace folia {
     return result;
   }
 
+  bool raw_input::fill(){
+    /// read the next block of input. false at the end
+    emit();
+    _buf.erase( 0, _pos );
+    _base += _pos;
+    _pos = _mark = 0;
+    char block[65536];
+    _is->read( block, sizeof(block) );
+    streamsize n = _is->gcount();
+    if ( n <= 0 ){
+      return false;
+    }
+    _buf.append( block, n );
+    return true;
+  }
+
+  void raw_input::emit(){
+    /// copy the bytes passed since the last call to the output, if any
+    if ( _out && _pos > _mark ){
+      _out->write( _buf.data() + _mark, _pos - _mark );
+    }
+    _mark = _pos;
+  }
+
+  void raw_input::select_output( ostream *os ){
+    /// from now on, copy the bytes we pass to os. drop them when os is 0
+    emit();
+    _out = os;
+  }
+
+  void raw_input::skip_past( const string& end ){
+    /// pass all bytes upto and including the string end
+    while ( peek() != EOF ){
+      size_t i = 0;
+      while ( i < end.size()
+	      && peek(i) == static_cast<unsigned char>(end[i]) ){
+	++i;
+      }
+      if ( i == end.size() ){
+	_pos += i;
+	return;
+      }
+      ++_pos;
+    }
+    throw XmlError( "Engine: unexpected end of the raw input" );
+  }
+
+  void raw_input::pass_text(){
+    /// pass all bytes upto the next markup
+    int c = peek();
+    while ( c != EOF && c != '<' ){
+      ++_pos;
+      c = peek();
+    }
+  }
+
+  raw_input::token raw_input::pass_token(){
+    /// pass the markup at the current position
+    /*!
+      \return the kind of markup. NONE at the end of the input
+    */
+    if ( peek() == EOF ){
+      return token::NONE;
+    }
+    int c = peek(1);
+    if ( c == '!' ){
+      if ( peek(2) == '-' && peek(3) == '-' ){
+	skip_past( "-->" );
+      }
+      else if ( peek(2) == '[' ){
+	skip_past( "]]>" );
+      }
+      else {
+	// a DOCTYPE, maybe with an internal subset
+	int nesting = 0;
+	int quote = 0;
+	++_pos;
+	for ( c = peek(); c != EOF; c = peek() ){
+	  ++_pos;
+	  if ( quote ){
+	    if ( c == quote ){
+	      quote = 0;
+	    }
+	  }
+	  else if ( c == '"' || c == '\'' ){
+	    quote = c;
+	  }
+	  else if ( c == '[' ){
+	    ++nesting;
+	  }
+	  else if ( c == ']' ){
+	    --nesting;
+	  }
+	  else if ( c == '>' && nesting == 0 ){
+	    break;
+	  }
+	}
+      }
+      return token::OTHER;
+    }
+    if ( c == '?' ){
+      skip_past( "?>" );
+      ++_count;
+      return token::PI;
+    }
+    bool is_end = ( c == '/' );
+    _pos += is_end ? 2 : 1;
+    _tag = is_end ? "</" : "<";
+    _name.clear();
+    for ( c = peek();
+	  c != EOF && c != '>' && c != '/' && !isspace(c);
+	  c = peek() ){
+      _name += static_cast<char>(c);
+      ++_pos;
+    }
+    _tag += _name;
+    int quote = 0;
+    int last = 0;
+    for ( c = peek(); c != EOF; c = peek() ){
+      ++_pos;
+      _tag += static_cast<char>(c);
+      if ( quote ){
+	if ( c == quote ){
+	  quote = 0;
+	}
+      }
+      else if ( c == '"' || c == '\'' ){
+	quote = c;
+      }
+      else if ( c == '>' ){
+	break;
+      }
+      last = c;
+    }
+    if ( c == EOF ){
+      throw XmlError( "Engine: unexpected end of the raw input" );
+    }
+    if ( is_end ){
+      return token::END;
+    }
+    ++_count;
+    return ( last == '/' ) ? token::EMPTY : token::START;
+  }
+
+  void raw_input::pass_root(){
+    /// drop all bytes upto and including the start tag of \<text> or
+    /// \<speech>, and start counting there
+    select_output( 0 );
+    while ( true ){
+      pass_text();
+      token t = pass_token();
+      if ( t == token::NONE ){
+	throw XmlError( "Engine: no <text> or <speech> found in the raw input" );
+      }
+      if ( t == token::START ){
+	string local = _name.substr( _name.find( ':' ) + 1 );
+	if ( local == "text" || local == "speech" ){
+	  break;
+	}
+      }
+    }
+    _count = 0;
+  }
+
+  bool raw_input::pass_to( size_t n, ostream *os ){
+    /// copy all bytes before element or PI number n+1 to os
+    /*!
+      \param n the number of elements and PI's to pass
+      \param os the output stream
+      \return false when the input ended first
+    */
+    select_output( os );
+    while ( true ){
+      pass_text();
+      int c = peek();
+      if ( c == EOF ){
+	return false;
+      }
+      int next = peek(1);
+      if ( _count == n
+	   && next != '/'
+	   && next != '!' ){
+	// at a start tag or a PI
+	return true;
+      }
+      pass_token();
+    }
+  }
+
+  void raw_input::skip_node(){
+    /// drop the element or PI at the current position, with all its content
+    select_output( 0 );
+    if ( pass_token() == token::START ){
+      int depth = 1;
+      while ( depth > 0 ){
+	pass_text();
+	switch ( pass_token() ){
+	case token::START:
+	  ++depth;
+	  break;
+	case token::END:
+	  --depth;
+	  break;
+	case token::NONE:
+	  throw XmlError( "Engine: unexpected end of the raw input" );
+	default:
+	  break;
+	}
+      }
+    }
+  }
+
+  void raw_input::pass_rest( ostream *os ){
+    /// copy all remaining bytes to os
+    select_output( os );
+    while ( peek() != EOF ){
+      _pos = _buf.size();
+    }
+    emit();
+  }
+
   xmlTextReader *create_text_reader( const string& buf ){
     /// create a new xmlTextRead on a buffer
     /*!
@@ -406,15 +658,12 @@ namespace folia {
     }
   }
 
-  bool Engine::init_doc( const string& file_name,
-			 const string& out_name ){
-    /// init an associated document for this Engine
+  void Engine::new_doc( const string& source_name,
+			const string& out_name ){
+    /// create the associated Document, and open the output file
     /*!
-      \param file_name the input file to use for parsing
+      \param source_name the name the Document gets as its filename
       \param out_name when not empty, add an output-file with this name
-
-      Initializing includes parsing the Document's metadata, style-sheet
-      upto and including the top \<text or \<speech> node
     */
     _ok = false;
     _out_doc = new Document();
@@ -426,13 +675,113 @@ namespace folia {
       _os = new ofstream( out_name );
       _out_name = out_name;
     }
-    _out_doc->_source_name = file_name;
+    _out_doc->_source_name = source_name;
+  }
+
+  bool Engine::init_doc( const string& file_name,
+			 const string& out_name ){
+    /// init an associated document for this Engine
+    /*!
+      \param file_name the input file to use for parsing
+      \param out_name when not empty, add an output-file with this name
+
+      Initializing includes parsing the Document's metadata, style-sheet
+      upto and including the top \<text or \<speech> node
+    */
+    new_doc( file_name, out_name );
     _reader = create_text_reader( file_name );
     if ( _reader == 0 ){
       _ok = false;
       throw( runtime_error( "folia::Engine(), init failed on '" + file_name
 			    + "' (File not found)" ) );
     }
+    return read_header();
+  }
+
+  static int read_input( void *context, char *buffer, int len ){
+    /// the xmlInputReadCallback for an Engine::read_function
+    /*!
+      libxml2 is C code, so no exception may pass. A failing read_function
+      is reported as an I/O error
+    */
+    const Engine::read_function *reader
+      = static_cast<const Engine::read_function*>(context);
+    try {
+      return (*reader)( buffer, len );
+    }
+    catch ( ... ){
+      return -1;
+    }
+  }
+
+  bool Engine::init_doc( const read_function& reader,
+			 const string& out_name ){
+    /// init an associated document for this Engine, reading from a function
+    /*!
+      \param reader the function which delivers the input. It is called
+      with a buffer and its size, and returns the number of bytes it placed
+      in it: 0 at the end of the input and -1 on an error
+      \param out_name when not empty, add an output-file with this name
+
+      The input is read in blocks, as the Engine proceeds. So only the
+      part of the document that is currently processed is held in memory.
+      Passthrough mode is not possible, as that needs to read the input
+      a second time
+    */
+    _input = reader;
+    new_doc( "", out_name );
+    _reader = xmlReaderForIO( read_input, 0, &_input,
+			      "input_stream", 0, XML_PARSER_OPTIONS );
+    if ( _reader == 0 ){
+      _ok = false;
+      throw( runtime_error( "folia::Engine(), init failed on the input stream" ) );
+    }
+    return read_header();
+  }
+
+  bool Engine::init_doc( istream& is, const string& out_name ){
+    /// init an associated document for this Engine, reading from a stream
+    /*!
+      \param is the input stream. It must stay available while the Engine
+      runs
+      \param out_name when not empty, add an output-file with this name
+
+      See init_doc( const read_function&, const string& )
+    */
+    return init_doc( [&is]( char *buffer, int len ){
+		       if ( is.bad() ){
+			 return -1;
+		       }
+		       is.read( buffer, len );
+		       return static_cast<int>( is.gcount() );
+		     },
+		     out_name );
+  }
+
+  bool Engine::init_doc( int fd, const string& out_name ){
+    /// init an associated document for this Engine, reading from a file
+    /// descriptor
+    /*!
+      \param fd an open file descriptor, like that of a pipe or a socket.
+      It is not closed by the Engine
+      \param out_name when not empty, add an output-file with this name
+
+      See init_doc( const read_function&, const string& )
+    */
+    return init_doc( [fd]( char *buffer, int len ){
+		       ssize_t n;
+		       do {
+			 n = ::read( fd, buffer, len );
+		       }
+		       while ( n < 0 && errno == EINTR );
+		       return static_cast<int>( n );
+		     },
+		     out_name );
+  }
+
+  bool Engine::read_header(){
+    /// parse the Document's metadata and style-sheet upto and including the
+    /// top \<text or \<speech> node, using the reader
     int index = 0;
     while ( xmlTextReaderRead(_reader) > 0 ){
       int type =  xmlTextReaderNodeType(_reader );
@@ -529,6 +878,8 @@ namespace folia {
     return _ok;
   }
 
+  int count_nodes( const FoliaElement * );
+
   void Engine::append_node( FoliaElement *t,
 			    int depth ){
     /// append a FoliaElement to the associated document
@@ -564,6 +915,9 @@ namespace folia {
     }
     _last_depth = depth;
     _current_node->append( t );
+    if ( _flush_policy == FlushPolicy::ELEMENT_COUNT ){
+      _held_nodes += count_nodes( t );
+    }
     if ( _debug ){
       DBG << "append_node() result = " << _current_node << endl;
     }
@@ -586,6 +940,9 @@ namespace folia {
       xmlNode *fd = xmlTextReaderExpand(_reader);
       t->parseXml( fd );
       append_node( t, new_depth );
+      if ( _scoped_refs ){
+	check_references( t );
+      }
       _external_node = t;
       if ( _debug ){
 	DBG << "expose external node: " << t << endl;
@@ -602,6 +959,64 @@ namespace folia {
     }
   }
 
+  ElementMatcher::ElementMatcher( const string& tags ):
+    ElementMatcher(){
+    /// compile a list of tags
+    /*!
+      \param tags a single tag like 'lemma' or a list of '|' separated tags
+      like 'lemma|pos|description'. The special tag 'PI' matches processing
+      instructions.
+      Throws a ValueError on unknown tags
+    */
+    for ( const auto& tag : TiCC::split_at( tags, "|" ) ){
+      if ( tag == "PI" ){
+	_pi = true;
+      }
+      else {
+	add( stringToElementType( tag ) );
+      }
+    }
+  }
+
+  ElementMatcher& ElementMatcher::add( ElementType et ){
+    /// also match elements of type et
+    _types.insert( et );
+    return *this;
+  }
+
+  ElementMatcher& ElementMatcher::with_attribute( const string& att,
+						  const string& val ){
+    /// only match elements that have attribute att with value val
+    /*!
+      \param att the attribute name, like 'set' or 'xml:id'
+      \param val the value it should have
+      All predicates must hold for a match.
+    */
+    _predicates.push_back( make_pair( att, val ) );
+    return *this;
+  }
+
+  bool ElementMatcher::matches( ElementType et, xmlTextReader *reader ) const {
+    /// test the element the reader is positioned on
+    /*!
+      \param et the ElementType of the element
+      \param reader the xmlTextReader, used to get the attributes
+      \return true when the element matches
+    */
+    if ( !_types.contains( et ) ){
+      return false;
+    }
+    for ( const auto& [att,val] : _predicates ){
+      xmlChar *value = xmlTextReaderGetAttribute( reader, to_xmlChar(att) );
+      bool ok = ( value && to_string_view( value ) == val );
+      xmlFree( value );
+      if ( !ok ){
+	return false;
+      }
+    }
+    return true;
+  }
+
   FoliaElement *Engine::get_node( const string& tag ){
     /// return the next node in the Engine with 'tag'
     /*!
@@ -612,6 +1027,303 @@ namespace folia {
       tags like 'lemma|pos|description'. In the latter case all named tags
       are tested and the first found is returned
 
+      The tag is compiled into an ElementMatcher, which is kept for the
+      next call with the same tag.
+    */
+    if ( tag != _last_tag ){
+      _last_matcher = ElementMatcher( tag );
+      _last_tag = tag;
+    }
+    return get_node( _last_matcher );
+  }
+
+  bool ElementMatcher::may_contain( ElementType et ) const {
+    /// may an element of type et have a matching descendant?
+    /*!
+      Based on the ACCEPTED_DATA of all types. Used to skip subtrees that
+      can't hold a match.
+    */
+    if ( _pi ){
+      // PI's may be anywhere
+      return true;
+    }
+    if ( !_holders_known ){
+      // the closure: the types that accept a match or a holder
+      const size_t count = static_cast<size_t>(ElementType::LastElement);
+      bool changed = true;
+      while ( changed ){
+	changed = false;
+	for ( size_t p=0; p < count; ++p ){
+	  ElementType parent = static_cast<ElementType>(p);
+	  if ( _holders.contains( parent ) ){
+	    continue;
+	  }
+	  for ( size_t c=0; c < count; ++c ){
+	    ElementType child = static_cast<ElementType>(c);
+	    if ( ( _types.contains( child ) || _holders.contains( child ) )
+		 && is_acceptable( parent, child ) ){
+	      _holders.insert( parent );
+	      changed = true;
+	      break;
+	    }
+	  }
+	}
+      }
+      _holders_known = true;
+    }
+    return _holders.contains( et );
+  }
+
+  void Engine::set_skip_scan( bool on, const ElementTypeSet& keep ){
+    /// switch to a read-only mode that only builds the matched nodes
+    /*!
+      \param on switch it on or off
+      \param keep the types of the ancestors of a match that are built too,
+      without their children. ancestors() returns them
+
+      In this mode, get_node() doesn't build the elements between the
+      matches, and skips all subtrees that can't hold a match. So the
+      Engine can't produce output.
+
+      A node returned by get_node() is not attached to the Document, and
+      stays valid until the next call. References to nodes outside it (like
+      \<wref>) can't be resolved.
+    */
+    if ( _os ){
+      throw logic_error( "folia::Engine::set_skip_scan() impossible with an output file" );
+    }
+    if ( _external_node && _skip_scan != on ){
+      throw logic_error( "folia::Engine::set_skip_scan() can only be changed before the first get_node()" );
+    }
+    if ( on && _scoped_refs ){
+      throw logic_error( "folia::Engine::set_skip_scan() impossible with scoped references" );
+    }
+    _skip_scan = on;
+    _keep_types = keep;
+  }
+
+  vector<FoliaElement*> Engine::ancestors() const {
+    /// in skip scan mode, return the built ancestors of the last match
+    /*!
+      \return the ancestors, outermost first. Only the types passed to
+      set_skip_scan() are present
+    */
+    vector<FoliaElement*> result;
+    for ( const auto& [depth,el] : _ancestors ){
+      result.push_back( el );
+    }
+    return result;
+  }
+
+  void Engine::drop_ancestors( int depth ){
+    /// delete the built ancestors at 'depth' and deeper
+    while ( !_ancestors.empty()
+	    && _ancestors.back().first >= depth ){
+      destroy( _ancestors.back().second );
+      _ancestors.pop_back();
+    }
+  }
+
+  FoliaElement *Engine::skip_to_node( const ElementMatcher& matcher ){
+    /// the skip scan version of get_node()
+    int ret = 0;
+    if ( _external_node != 0 ){
+      destroy( _external_node );
+      _external_node = 0;
+      ret = xmlTextReaderNext(_reader);
+    }
+    else {
+      ret = xmlTextReaderRead(_reader);
+    }
+    while ( ret == 1 ){
+      int type = xmlTextReaderNodeType(_reader);
+      if ( type == XML_READER_TYPE_ELEMENT ){
+	int depth = xmlTextReaderDepth(_reader);
+	drop_ancestors( depth );
+	string_view name = to_string_view(xmlTextReaderConstLocalName(_reader));
+	ElementType et;
+	if ( !lookupElementType( name, et ) ){
+	  // not FoLiA
+	  ret = xmlTextReaderNext(_reader);
+	  continue;
+	}
+	if ( matcher.matches( et, _reader ) ){
+	  FoliaElement *t = AbstractElement::createElement( et, _out_doc );
+	  t->parseXml( xmlTextReaderExpand(_reader) );
+	  _external_node = t;
+	  return t;
+	}
+	if ( !matcher.may_contain( et ) ){
+	  ret = xmlTextReaderNext(_reader);
+	  continue;
+	}
+	if ( _keep_types.contains( et )
+	     && !xmlTextReaderIsEmptyElement(_reader) ){
+	  FoliaElement *t = AbstractElement::createElement( et, _out_doc );
+	  KWargs atts = get_attributes( _reader );
+	  t->setAttributes( atts );
+	  _ancestors.push_back( make_pair( depth, t ) );
+	}
+      }
+      else if ( type == XML_READER_TYPE_PROCESSING_INSTRUCTION
+		&& matcher.matches_pi() ){
+	drop_ancestors( xmlTextReaderDepth(_reader) );
+	FoliaElement *t = AbstractElement::createElement( "PI", _out_doc );
+	t->parseXml( xmlTextReaderExpand(_reader) );
+	_external_node = t;
+	return t;
+      }
+      ret = xmlTextReaderRead(_reader);
+    }
+    if ( ret < 0 ){
+      throw runtime_error( "get_node() reading failed" );
+    }
+    drop_ancestors( 0 );
+    _done = true;
+    return 0;
+  }
+
+  void Engine::set_passthrough( bool on ){
+    /// copy the input bytes of all unmatched parts straight to the output
+    /*!
+      \param on switch it on or off
+
+      In this mode, get_node() builds the matched nodes only, like in skip
+      scan mode, and everything in between is copied to the output file
+      byte for byte. Only the header, upto and including the \<text> or
+      \<speech> start tag, and the matched nodes are serialized. So the
+      formatting of the rest is kept, and the costs are mostly I/O.
+
+      A matched node is output when the next get_node() call is done, so
+      all changes made to it until then are kept. A node returned by
+      get_node() is not attached to the Document. References to nodes
+      outside it (like \<wref>) can't be resolved. When get_node() isn't
+      called until the end, finish() copies the remainder of the input.
+
+      Only uncompressed input is supported. The mode can't be combined with
+      auto-flush, skip scan, process() or a TextEngine.
+    */
+    if ( !_os ){
+      throw logic_error( "folia::Engine::set_passthrough() impossible. No outputfile specified!" );
+    }
+    if ( _external_node || _done || _root_node->size() > 0 ){
+      throw logic_error( "folia::Engine::set_passthrough() can only be called before the first get_node()" );
+    }
+    if ( !on ){
+      delete _raw;
+      _raw = 0;
+      return;
+    }
+    if ( _flush_policy != FlushPolicy::NONE ){
+      throw logic_error( "folia::Engine::set_passthrough() impossible with auto-flush" );
+    }
+    if ( !_checkpoint_file.empty() ){
+      throw logic_error( "folia::Engine::set_passthrough() impossible with checkpoints" );
+    }
+    if ( _raw ){
+      return;
+    }
+    if ( _input ){
+      throw logic_error( "folia::Engine::set_passthrough() needs an input file, not a stream" );
+    }
+    if ( _scoped_refs ){
+      throw logic_error( "folia::Engine::set_passthrough() impossible with scoped references" );
+    }
+    const string& source = _out_doc->_source_name;
+    istream *is = 0;
+    if ( TiCC::match_front( source, "<?xml " ) ){
+      is = new istringstream( source );
+    }
+    else if ( TiCC::match_back( source, ".bz2" )
+	      || TiCC::match_back( source, ".gz" ) ){
+      throw logic_error( "folia::Engine::set_passthrough() needs an uncompressed input file" );
+    }
+    else {
+      is = new ifstream( source, ios::binary );
+      if ( !is->good() ){
+	delete is;
+	throw runtime_error( "folia::Engine::set_passthrough() can't reopen '"
+			     + source + "'" );
+      }
+    }
+    _raw = new raw_input( is );
+    _raw->pass_root();
+    _read_count = 0;
+  }
+
+  void Engine::output_match(){
+    /// in passthrough mode, output the pending match and delete it
+    if ( _external_node ){
+      *_os << _external_node->xmlstring( true, _match_depth, false );
+      destroy( _external_node );
+      _external_node = 0;
+    }
+  }
+
+  FoliaElement *Engine::pass_to_node( const ElementMatcher& matcher ){
+    /// the passthrough version of get_node()
+    if ( !_header_done ){
+      output_header();
+    }
+    int ret = 0;
+    if ( _external_node != 0 ){
+      output_match();
+      ret = xmlTextReaderNext(_reader);
+      _read_count = _raw->count();
+    }
+    else {
+      ret = xmlTextReaderRead(_reader);
+    }
+    while ( ret == 1 ){
+      int type = xmlTextReaderNodeType(_reader);
+      if ( type == XML_READER_TYPE_ELEMENT
+	   || type == XML_READER_TYPE_PROCESSING_INSTRUCTION ){
+	++_read_count;
+	FoliaElement *t = 0;
+	if ( type == XML_READER_TYPE_ELEMENT ){
+	  string_view name = to_string_view(xmlTextReaderConstLocalName(_reader));
+	  ElementType et;
+	  if ( lookupElementType( name, et )
+	       && matcher.matches( et, _reader ) ){
+	    t = AbstractElement::createElement( et, _out_doc );
+	  }
+	}
+	else if ( matcher.matches_pi() ){
+	  t = AbstractElement::createElement( "PI", _out_doc );
+	}
+	if ( t ){
+	  if ( !_raw->pass_to( _read_count - 1, _os ) ){
+	    destroy( t );
+	    throw logic_error( "folia::Engine: raw input out of step with the reader" );
+	  }
+	  _raw->skip_node();
+	  _match_depth = xmlTextReaderDepth(_reader);
+	  try {
+	    t->parseXml( xmlTextReaderExpand(_reader) );
+	  }
+	  catch ( ... ){
+	    destroy( t );
+	    throw;
+	  }
+	  _external_node = t;
+	  return t;
+	}
+      }
+      ret = xmlTextReaderRead(_reader);
+    }
+    if ( ret < 0 ){
+      throw runtime_error( "get_node() reading failed" );
+    }
+    _done = true;
+    return 0;
+  }
+
+  FoliaElement *Engine::get_node( const ElementMatcher& matcher ){
+    /// return the next node in the Engine that matches
+    /*!
+      \param matcher the precompiled test
+      \return the FoliaElement found.
+
       The returned FoliaElement is a FoLiA subtree expaned from the
       xmlTextReader. Further parsing will continue at the next sibbling
       of the parent.
@@ -623,10 +1335,22 @@ namespace folia {
       return 0;
     }
     if ( _debug ){
-      DBG << "Engine::get_node(), for tag=" << tag << endl;
+      DBG << "Engine::get_node()" << endl;
+    }
+    if ( _raw ){
+      return pass_to_node( matcher );
+    }
+    if ( _skip_scan ){
+      return skip_to_node( matcher );
     }
+    auto_flush();
     int ret = 0;
-    if ( _external_node != 0 ){
+    if ( _at_resume_node ){
+      // resume() has positioned the reader
+      _at_resume_node = false;
+      ret = 1;
+    }
+    else if ( _external_node != 0 ){
       // so our last action was to output a pointer to a subtree.
       // continue with the next node, avoiding the subtree
       _external_node = 0;
@@ -646,22 +1370,23 @@ namespace folia {
       _done = true;
       return 0;
     }
-    vector<string> tv = TiCC::split_at( tag, "|" );
-    set<string> tags;
-    for ( const auto& t : tv ){
-      tags.insert(t);
-    }
     while ( ret ){
       int type = xmlTextReaderNodeType(_reader);
       int new_depth = xmlTextReaderDepth(_reader);
       switch ( type ){
       case XML_READER_TYPE_ELEMENT: {
-	string local_name = to_string(xmlTextReaderConstLocalName(_reader));
+	string_view name = to_string_view(xmlTextReaderConstLocalName(_reader));
 	if ( _debug ){
-	  DBG << "get node XML_ELEMENT name=" << local_name
+	  DBG << "get node XML_ELEMENT name=" << name
 	      << " depth " << _last_depth << " ==> " << new_depth << endl;
 	}
-	if ( tags.find(local_name) != tags.end() ){
+	if ( new_depth == 2 ){
+	  top_node_start();
+	}
+	ElementType et;
+	string local_name( name );
+	if ( lookupElementType( name, et )
+	     && matcher.matches( et, _reader ) ){
 	  if ( _debug ){
 	    DBG << "matched search tag: " << local_name << endl;
 	  }
@@ -681,7 +1406,7 @@ namespace folia {
 	throw XmlError( "spurious text found." );
 	break;
       case XML_READER_TYPE_PROCESSING_INSTRUCTION:
-	if ( tags.find( "PI" ) != tags.end() ){
+	if ( matcher.matches_pi() ){
 	  _external_node = handle_match( "PI", new_depth );
 	  return _external_node;
 	}
@@ -702,6 +1427,253 @@ namespace folia {
     return 0;
   }
 
+  struct pipeline_state {
+    /// the shared state of the threads of Engine::process()
+    mutex tree_lock;  ///< guards the output tree: reading and detaching
+    mutex lock;       ///< guards all members below
+    condition_variable work_cv;  ///< signals new jobs for the workers
+    condition_variable room_cv;  ///< signals room in the queue for the reader
+    condition_variable write_cv; ///< signals progress to the writer
+    deque<FoliaElement*> queue;  ///< matched subtrees waiting for a worker
+    multiset<const FoliaElement*> busy_tops; ///< the top level nodes
+    ///< that still hold unprocessed subtrees
+    size_t pending = 0;   ///< the number of queued and running subtrees
+    size_t events = 0;    ///< changes whenever the writer might proceed
+    bool reading_done = false;
+    bool stop = false;    ///< set on the first error
+    exception_ptr error;
+    void fail( exception_ptr e ){
+      /// register an error, and stop all threads
+      unique_lock<mutex> lk( lock );
+      if ( !error ){
+	error = e;
+      }
+      stop = true;
+      ++events;
+      lk.unlock();
+      work_cv.notify_all();
+      room_cv.notify_all();
+      write_cv.notify_all();
+    }
+  };
+
+  void Engine::process( const string& tag,
+			const node_handler& handler,
+			unsigned int workers,
+			size_t max_pending ){
+    /// run a handler on all nodes with 'tag', on a pool of threads
+    /*!
+      \param tag the tag or a list of '|' separated tags, like for get_node()
+      \param handler the function to call on every matched subtree
+      \param workers the number of threads calling the handler. 0 means: use
+      all cores
+      \param max_pending the maximum number of matched subtrees that may
+      wait for, or be in, the handler. When reached, reading pauses. 0 means:
+      4 times the number of workers
+
+      The calling thread reads the input and expands the matched subtrees.
+      The workers run the handler on them concurrently, and one writer
+      thread outputs every top level node (a child of \<text> or \<speech>)
+      as soon as it is read completely and all its matched subtrees are
+      handled. So the output is in input order, and the processed nodes are
+      deleted.
+
+      The handler may modify the subtree BELOW the node it gets at will, and
+      may add annotations, ids, declarations etc. to the Document. It should
+      not look at or touch other parts of the tree, like the parent or the
+      siblings of the node.
+      The header is output together with the first top level node, so new
+      declarations (explicit, or implicit by adding annotation of an
+      undeclared type) must be made before that node is completely handled.
+      Any later new declaration throws a DeclarationError.
+
+      The first exception from the reader or a handler stops the processing,
+      and is rethrown here. Call finish() afterwards, to output the footer.
+    */
+    if ( _debug ){
+      DBG << "Engine::process(), for tag=" << tag << endl;
+    }
+    if ( !_os ){
+      throw logic_error( "folia::Engine::process() impossible. No outputfile specified!" );
+    }
+    if ( _finished ){
+      throw logic_error( "folia::Engine::process() called after finish()" );
+    }
+    if ( _raw ){
+      throw logic_error( "folia::Engine::process() impossible in passthrough mode" );
+    }
+    if ( !_checkpoint_file.empty() ){
+      throw logic_error( "folia::Engine::process() doesn't support checkpoints" );
+    }
+    if ( workers == 0 ){
+      workers = std::max( 1u, thread::hardware_concurrency() );
+    }
+    if ( max_pending == 0 ){
+      max_pending = 4 * workers;
+    }
+    if ( _header_done || _root_node->size() > 0 ){
+      // output all nodes handled until now
+      flush();
+    }
+    // otherwise the writer holds the header back until the first top level
+    // node is handled, so the declarations made for it are included
+    // the writer takes care of the output
+    FlushPolicy policy = _flush_policy;
+    _flush_policy = FlushPolicy::NONE;
+    pipeline_state st;
+    auto worker = [&](){
+      while ( true ){
+	FoliaElement *node = 0;
+	{
+	  unique_lock<mutex> lk( st.lock );
+	  st.work_cv.wait( lk, [&]{
+	      return st.stop || !st.queue.empty() || st.reading_done;
+	    } );
+	  if ( st.stop || st.queue.empty() ){
+	    return;
+	  }
+	  node = st.queue.front();
+	  st.queue.pop_front();
+	}
+	try {
+	  handler( node );
+	}
+	catch ( ... ){
+	  st.fail( current_exception() );
+	  return;
+	}
+	const FoliaElement *top = node;
+	while ( top->parent() != _root_node ){
+	  top = top->parent();
+	}
+	{
+	  lock_guard<mutex> lk( st.lock );
+	  st.busy_tops.erase( st.busy_tops.find( top ) );
+	  --st.pending;
+	  ++st.events;
+	}
+	st.room_cv.notify_one();
+	st.write_cv.notify_one();
+      }
+    };
+    auto writer = [&](){
+      try {
+	while ( true ){
+	  vector<FoliaElement*> ready;
+	  size_t seen = 0;
+	  bool all_done = false;
+	  {
+	    lock_guard<mutex> tk( st.tree_lock );
+	    lock_guard<mutex> lk( st.lock );
+	    if ( st.stop ){
+	      return;
+	    }
+	    seen = st.events;
+	    size_t length = _root_node->size();
+	    for ( size_t i=0; i < length; ++i ){
+	      FoliaElement *top = _root_node->index(i);
+	      if ( ( i == length-1 && !st.reading_done )
+		   || st.busy_tops.find( top ) != st.busy_tops.end() ){
+		// still being read or handled
+		break;
+	      }
+	      ready.push_back( top );
+	    }
+	    for ( const auto& top : ready ){
+	      _root_node->remove( top );
+	    }
+	    all_done = st.reading_done && st.pending == 0
+	      && ready.size() == length;
+	  }
+	  if ( !_header_done && !ready.empty() ){
+	    // block the handlers that add a declaration meanwhile
+	    auto guard = _out_doc->shared_guard();
+	    output_header();
+	  }
+	  for ( const auto& top : ready ){
+	    *_os << "    " << top->xmlstring(true,2,false) << endl;
+	    destroy( top );
+	  }
+	  if ( all_done ){
+	    return;
+	  }
+	  if ( ready.empty() ){
+	    unique_lock<mutex> lk( st.lock );
+	    st.write_cv.wait( lk, [&]{ return st.stop || st.events != seen; } );
+	  }
+	}
+      }
+      catch ( ... ){
+	st.fail( current_exception() );
+      }
+    };
+    bool concurrent = _out_doc->concurrent_updates();
+    _out_doc->set_concurrent_updates( true );
+    vector<thread> pool;
+    for ( unsigned int i=0; i < workers; ++i ){
+      pool.emplace_back( worker );
+    }
+    thread output( writer );
+    try {
+      while ( true ){
+	{
+	  unique_lock<mutex> lk( st.lock );
+	  st.room_cv.wait( lk, [&]{
+	      return st.stop || st.pending < max_pending;
+	    } );
+	  if ( st.stop ){
+	    break;
+	  }
+	}
+	FoliaElement *node = 0;
+	const FoliaElement *top = 0;
+	{
+	  lock_guard<mutex> tk( st.tree_lock );
+	  node = get_node( tag );
+	  if ( node ){
+	    top = node;
+	    while ( top->parent() != _root_node ){
+	      top = top->parent();
+	    }
+	  }
+	}
+	{
+	  lock_guard<mutex> lk( st.lock );
+	  if ( node ){
+	    st.queue.push_back( node );
+	    st.busy_tops.insert( top );
+	    ++st.pending;
+	  }
+	  else {
+	    st.reading_done = true;
+	  }
+	  ++st.events;
+	}
+	st.write_cv.notify_one();
+	if ( node ){
+	  st.work_cv.notify_one();
+	}
+	else {
+	  st.work_cv.notify_all();
+	  break;
+	}
+      }
+    }
+    catch ( ... ){
+      st.fail( current_exception() );
+    }
+    for ( auto& t : pool ){
+      t.join();
+    }
+    output.join();
+    _out_doc->set_concurrent_updates( concurrent );
+    _flush_policy = policy;
+    if ( st.error ){
+      _ok = false;
+      rethrow_exception( st.error );
+    }
+  }
+
   xml_tree *Engine::create_simple_tree( const string& in_file ) const {
     /// create a lightweight tree for enumerating all XML_ELEMENTS encountered
     /*!
@@ -915,6 +1887,9 @@ namespace folia {
       }
       ref->increfcount();
       append_node( ref, new_depth );
+      if ( _scoped_refs ){
+	check_references( _current_node );
+      }
     }
     else {
       FoliaElement *t = AbstractElement::createElement( local_name, _out_doc );
@@ -1017,63 +1992,13 @@ namespace folia {
       throw logic_error( "folia::Engine::output_header() is called twice!" );
     }
     _header_done = true;
-    stringstream ss;
-    _out_doc->save( ss, ns_prefix );
-    string data = ss.str();
-    string search_b1;
-    string search_b2;
-    string search_e;
-    if ( _doc_type == DocType::TEXT ){
-      if ( !ns_prefix.empty() ){
-	search_b1 = "<" + ns_prefix + ":" + "text>";
-	search_b2 = "<" + ns_prefix + ":" + "text ";
-	search_e = "</" + ns_prefix + ":" + "text>";
-      }
-      else {
-	search_b1 = "<text>";
-	search_b2 = "<text ";
-	search_e = "</text>";
-      }
+    _footer = _out_doc->save_prologue( *_os, ns_prefix );
+    // from now on, a new declaration can't reach the output anymore
+    _out_doc->freeze_declarations( true );
+    if ( !_raw ){
+      // in passthrough mode, the raw input has the line ends
+      *_os << endl;
     }
-    else {
-      if ( !ns_prefix.empty() ){
-	search_b1 = "<" + ns_prefix + ":" + "speech>";
-	search_b2 = "<" + ns_prefix + ":" + "speech ";
-	search_e = "</" + ns_prefix + ":" + "speech>";
-      }
-      else {
-	search_b1 = "<speech>";
-	search_b2 = "<speech ";
-	search_e = "</speech>";
-      }
-    }
-    string::size_type bpos1 = data.find( search_b1 );
-    string::size_type bpos2 = data.find( search_b2 );
-    string::size_type pos1;
-    if ( bpos1 < bpos2 ){
-      pos1 = bpos1;
-    }
-    else {
-      pos1 = bpos2;
-    }
-    string::size_type pos2;
-    if ( _root_node->size() == 0 ){
-      pos2 = data.find( "/>" , pos1 );
-    }
-    else {
-      pos2 = data.find( ">" , pos1 );
-    }
-    string head = data.substr( 0, pos2 ) + ">";
-    if ( _root_node->size() == 0 ){
-      pos2 += 2;
-    }
-    else {
-      pos2 = data.find( search_e, pos1 );
-      int add = search_e.size();
-      pos2 += add;
-    }
-    _footer = "  " + search_e + data.substr( pos2 );
-    *_os << head << endl;
     return true;
   }
 
@@ -1089,10 +2014,23 @@ namespace folia {
       if ( !_os ){
 	throw logic_error( "folia::Engine::output_footer() impossible. No output file specified!" );
       }
+      else if ( _raw ){
+	if ( !_header_done ){
+	  output_header();
+	}
+	output_match();
+	// the rest of the input, including the end tags
+	_raw->pass_rest( _os );
+	_finished = true;
+      }
       else {
 	flush();
 	*_os << _footer << endl;
 	_finished = true;
+	if ( !_checkpoint_file.empty() ){
+	  // the run is complete
+	  remove( _checkpoint_file.c_str() );
+	}
       }
     }
   }
@@ -1111,6 +2049,9 @@ namespace folia {
       if ( !_header_done ){
 	output_header();
       }
+      while ( !_open_nodes.empty() ){
+	close_open_node();
+      }
       stack<FoliaElement*> rem_list;
       size_t length = _root_node->size();
       for ( size_t i=0; i < length; ++i ){
@@ -1121,12 +2062,564 @@ namespace folia {
 	// we've kept a stack of elements to remove, as removing at the back
 	// is the safest and cheapest thing to do
 	_root_node->remove( rem_list.top() );
-	destroy( rem_list.top() );
+	release( rem_list.top() );
 	rem_list.pop();
       }
+      _held_nodes = 0;
+      drop_reader_ids();
+    }
+  }
+
+  void Engine::set_auto_flush( FlushPolicy policy, size_t limit ){
+    /// let the Engine output and delete the processed nodes by itself
+    /*!
+      \param policy when to flush:
+      - TOP_NODES: output every completed top level node (a child of
+      \<text> or \<speech>)
+      - ELEMENT_COUNT: output all completed subtrees, at any depth, when
+      more than \e limit elements are held
+      - BYTE_BUDGET: output all completed subtrees, at any depth, after
+      every \e limit bytes of input. libxml2 parses the input in chunks of
+      some hundreds of bytes, so that is the granularity
+      - NONE: only output on flush() and finish()
+      \param limit the element count or the number of bytes
+
+      The check is done at every call of get_node() or next_text_parent(),
+      so all nodes returned earlier may be deleted by then. For a deep
+      flush, the start tags of the ancestors of the current node are output
+      first; these nodes are kept until they are completed. So changes to
+      their attributes after that moment are lost.
+      References (like \<wref>) to output nodes can't be resolved anymore.
+      See set_scoped_references() to free the memory of the output nodes too.
+
+      The header, with all annotation declarations, is output together
+      with the first flushed node. Any new declaration after that moment
+      (explicit, or implicit by adding annotation of an undeclared type)
+      throws a DeclarationError. So declare up front, or at the latest while
+      handling the first node.
+    */
+    if ( !_os ){
+      throw logic_error( "folia::Engine::set_auto_flush() impossible. No outputfile specified!" );
+    }
+    if ( _raw && policy != FlushPolicy::NONE ){
+      throw logic_error( "folia::Engine::set_auto_flush() impossible in passthrough mode" );
+    }
+    if ( policy != FlushPolicy::NONE
+	 && policy != FlushPolicy::TOP_NODES
+	 && limit == 0 ){
+      throw invalid_argument( "folia::Engine::set_auto_flush() needs a limit" );
+    }
+    _flush_policy = policy;
+    _flush_limit = limit;
+    _held_nodes = count_nodes( _root_node );
+    _flushed_bytes = _reader ? xmlTextReaderByteConsumed( _reader ) : 0;
+  }
+
+  string start_tag( const FoliaElement *node ){
+    /// return the XML start tag of a node, with all its attributes
+    xmlNode *n = node->xml( false, false );
+    xmlBuffer *buf = xmlBufferCreate();
+    xmlNodeDump( buf, 0, n, 0, 0 );
+    string tag = to_string( xmlBufferContent( buf ) );
+    xmlBufferFree( buf );
+    xmlFreeNode( n );
+    if ( TiCC::match_back( tag, "/>" ) ){
+      tag = tag.substr( 0, tag.size()-2 ) + ">";
+    }
+    return tag;
+  }
+
+  void Engine::auto_flush(){
+    /// flush the completed nodes, when the policy says so
+    if ( _finished ){
+      return;
+    }
+    switch ( _flush_policy ){
+    case FlushPolicy::NONE:
+      break;
+    case FlushPolicy::TOP_NODES:
+      flush_completed( false );
+      break;
+    case FlushPolicy::ELEMENT_COUNT:
+      if ( _held_nodes > _flush_limit ){
+	flush_completed( true );
+	_held_nodes = count_nodes( _root_node );
+      }
+      break;
+    case FlushPolicy::BYTE_BUDGET: {
+      long consumed = xmlTextReaderByteConsumed( _reader );
+      if ( consumed - _flushed_bytes >= static_cast<long>(_flush_limit) ){
+	flush_completed( true );
+	_flushed_bytes = consumed;
+      }
+    }
+      break;
+    }
+  }
+
+  static bool is_reference_scope( const FoliaElement *node ){
+    /// does node bound the references in scoped mode?
+    return node->element_id() == ElementType::Sentence_t
+      || node->element_id() == ElementType::Paragraph_t;
+  }
+
+  void Engine::flush_completed( bool deep ){
+    /// output and delete all nodes that are completely read
+    /*!
+      \param deep when false, only look at the top level nodes. Otherwise
+      look at all levels
+
+      The nodes that are still open are the current node and its ancestors.
+      The last added node is treated as open too, as more children might
+      follow.
+      The header is output when the first completed node is, so the
+      declarations made while handling that node are included.
+    */
+    FoliaElement *leaf = _current_node;
+    if ( _last_added && _last_added->parent() == _current_node ){
+      leaf = _last_added;
+    }
+    vector<FoliaElement*> chain;
+    for ( FoliaElement *n = leaf; n && n != _root_node; n = n->parent() ){
+      chain.insert( chain.begin(), n );
+    }
+    if ( _debug ){
+      DBG << "Engine::flush_completed(), open chain of " << chain.size()
+	  << " nodes" << endl;
+    }
+    // close the output nodes that are done now
+    size_t common = 0;
+    while ( common < _open_nodes.size()
+	    && common < chain.size()
+	    && _open_nodes[common] == chain[common] ){
+      ++common;
+    }
+    bool released = _open_nodes.size() > common;
+    while ( _open_nodes.size() > common ){
+      close_open_node();
+    }
+    FoliaElement *par = _root_node;
+    for ( size_t i=0; i < chain.size(); ++i ){
+      size_t done = 0;
+      while ( par->index(done) != chain[i] ){
+	++done;
+      }
+      if ( done > 0 ){
+	if ( !_header_done ){
+	  output_header();
+	}
+	while ( _open_nodes.size() < i ){
+	  // output the start tags of the ancestors
+	  FoliaElement *anc = chain[_open_nodes.size()];
+	  *_os << string( 4 + 2*_open_nodes.size(), ' ' ) << start_tag( anc )
+	       << endl;
+	  _open_nodes.push_back( anc );
+	}
+	output_children( par, done, 2+i );
+	released = true;
+      }
+      if ( !deep
+	   || ( _scoped_refs && is_reference_scope( chain[i] ) ) ){
+	// with scoped references, an open scope is kept whole, as its
+	// children may still be referenced
+	break;
+      }
+      par = chain[i];
+    }
+    if ( released ){
+      drop_reader_ids();
+    }
+  }
+
+  void Engine::output_children( FoliaElement *par,
+				size_t count,
+				size_t level ){
+    /// output the first children of a node, and delete them
+    /*!
+      \param par the node
+      \param count the number of children to output
+      \param level the nesting level of the children in the output
+    */
+    stack<FoliaElement*> rem_list;
+    for ( size_t i=0; i < count; ++i ){
+      rem_list.push( par->index(i) );
+      *_os << string( 2*level, ' ' ) << par->index(i)->xmlstring(true,level,false)
+	   << endl;
+    }
+    while ( !rem_list.empty() ){
+      // remove from the back, like in flush()
+      par->remove( rem_list.top() );
+      release( rem_list.top() );
+      rem_list.pop();
+    }
+  }
+
+  void Engine::close_open_node(){
+    /// output the remaining children and the end tag of the deepest open
+    /// node, and delete it
+    FoliaElement *node = _open_nodes.back();
+    size_t level = 1 + _open_nodes.size();
+    output_children( node, node->size(), level + 1 );
+    string tag = start_tag( node );
+    tag = tag.substr( 1, tag.find_first_of( " />" ) - 1 );
+    *_os << string( 2*level, ' ' ) << "</" << tag << ">" << endl;
+    _open_nodes.pop_back();
+    FoliaElement *par = node->parent();
+    par->remove( node );
+    release( node );
+  }
+
+  void Engine::check_references( const FoliaElement *node ) const {
+    /// check that all references in the subtree of node stay in their scope
+    /*!
+      \param node the subtree to check. It must be attached to the Document
+
+      A reference is a child that has another parent, like the word a
+      \<wref> points to. It must lie within the nearest \<s> or \<p> that
+      holds the reference. Throws an XmlError otherwise
+    */
+    for ( size_t i=0; i < node->size(); ++i ){
+      const FoliaElement *child = node->index(i);
+      if ( child->parent() == node ){
+	check_references( child );
+	continue;
+      }
+      const FoliaElement *scope = node;
+      while ( scope && !is_reference_scope( scope ) ){
+	scope = scope->parent();
+      }
+      if ( !scope ){
+	throw XmlError( "folia::engine, scoped reference to '" + child->id()
+			+ "' outside any <s> or <p>" );
+      }
+      const FoliaElement *up = child->parent();
+      while ( up && up != scope ){
+	up = up->parent();
+      }
+      if ( !up ){
+	throw XmlError( "folia::engine, reference to '" + child->id()
+			+ "' outside its enclosing <" + scope->xmltag() + ">" );
+      }
+    }
+  }
+
+  void Engine::release( FoliaElement *node ){
+    /// delete a node that is output
+    /*!
+      \param node the node, already detached from its parent
+
+      Normally, destroy() keeps every referable node (like a Word) alive,
+      and in the index, until the Document is deleted, because a later
+      reference might need it. With scoped references, all references to
+      the subtree come from within it, so the whole subtree is deleted at
+      once.
+    */
+    if ( !_scoped_refs ){
+      destroy( node );
+      return;
+    }
+    set<FoliaElement*> bulk;
+    node->unravel( bulk );
+    for ( const auto& el : bulk ){
+      el->destroy();
+    }
+  }
+
+  void Engine::drop_reader_ids(){
+    /// with scoped references, forget the xml:id's libxml2 collected
+    /*!
+      The xmlTextReader keeps every xml:id it met in the ID table of its
+      own document, until the end of the input, and there is no parser
+      option to prevent that. Duplicates are checked against our own index,
+      so in scoped mode the table is freed, once per flush. The reader
+      creates a new one on the next id.
+      Checked against libxml2 2.13.8: in streaming mode the entries only
+      hold a copy of the id, not a pointer to the attribute.
+    */
+    if ( !_scoped_refs || !_reader ){
+      return;
+    }
+    xmlNode *cur = xmlTextReaderCurrentNode( _reader );
+    if ( cur && cur->doc && cur->doc->ids ){
+      xmlFreeIDTable( static_cast<xmlIDTablePtr>(cur->doc->ids) );
+      cur->doc->ids = 0;
+    }
+  }
+
+  void Engine::set_scoped_references( bool on ){
+    /// limit the references (like \<wref>) to the enclosing \<s> or \<p>
+    /*!
+      \param on switch it on or off
+
+      In this mode, a reference must point to a node within the nearest
+      sentence or paragraph that holds the reference. Otherwise an XmlError
+      is thrown. In return, flushed nodes are deleted at once, and their
+      ids are removed from the index, so span annotated documents can be
+      streamed in bounded memory. Normally, every referable node is kept
+      until the end, as a later reference might need it.
+
+      A deep auto-flush doesn't output the completed parts of an open
+      sentence or paragraph then. References added to the Document by the
+      caller must obey the same rule.
+    */
+    if ( _skip_scan || _raw ){
+      throw logic_error( "folia::Engine::set_scoped_references() impossible in skip scan or passthrough mode" );
+    }
+    _scoped_refs = on;
+  }
+
+  void Engine::set_checkpoint( const string& file_name, size_t every ){
+    /// write checkpoints during the run, so it can be resumed after a crash
+    /*!
+      \param file_name the checkpoint file. It is replaced atomically by
+      every new checkpoint, and removed when the run is finished
+      \param every write a checkpoint every this many top level nodes (the
+      children of \<text> or \<speech>)
+
+      A checkpoint is made when the reader starts a new top level node. At
+      that moment, all completed nodes are output and deleted, and the
+      position in the input, the size of the output, and the header, with
+      all declarations made sofar, are saved. See resume()
+    */
+    if ( !_os ){
+      throw logic_error( "folia::Engine::set_checkpoint() impossible. No outputfile specified!" );
+    }
+    if ( _raw ){
+      throw logic_error( "folia::Engine::set_checkpoint() impossible in passthrough mode" );
+    }
+    if ( every == 0 ){
+      throw invalid_argument( "folia::Engine::set_checkpoint() needs an interval" );
+    }
+    _checkpoint_file = file_name;
+    _checkpoint_every = every;
+  }
+
+  void Engine::top_node_start(){
+    /// called when the reader meets a new top level node. So all earlier
+    /// ones are complete
+    if ( !_checkpoint_file.empty()
+	 && _top_nodes > 0
+	 && _top_nodes != _last_checkpoint
+	 && _top_nodes % _checkpoint_every == 0 ){
+      write_checkpoint();
+    }
+    ++_top_nodes;
+  }
+
+  void Engine::save_state( KWargs& state ) const {
+    /// add the values needed to resume to a checkpoint
+    state.add( "every", TiCC::toString( _checkpoint_every ) );
+    state.add( "top_nodes", TiCC::toString( _top_nodes ) );
+    state.add( "footer", _footer );
+    stringstream ss;
+    _out_doc->save_prologue( ss, ns_prefix );
+    state.add( "prologue", ss.str() );
+    const AllowGenerateID *root = dynamic_cast<const AllowGenerateID*>(_root_node);
+    if ( root ){
+      KWargs counters;
+      for ( const auto& [tag,count] : root->id_counters() ){
+	counters.add( tag, TiCC::toString( count ) );
+      }
+      state.add( "id_counters", toString( counters ) );
+    }
+    // the defaults of the input header, which may be obscured by the
+    // declarations added since
+    KWargs sets;
+    for ( const auto& [type,set] : _out_doc->_orig_ann_default_sets ){
+      sets.add( toString( type ), set );
+    }
+    state.add( "default_sets", toString( sets ) );
+    KWargs procs;
+    for ( const auto& [type,proc] : _out_doc->_orig_ann_default_procs ){
+      procs.add( toString( type ), proc );
+    }
+    state.add( "default_processors", toString( procs ) );
+  }
+
+  void Engine::restore_state( const KWargs& state ){
+    /// restore the values from a checkpoint, see save_state()
+    _checkpoint_every = TiCC::stringTo<size_t>( state.lookup( "every" ) );
+    _top_nodes = TiCC::stringTo<size_t>( state.lookup( "top_nodes" ) );
+    _last_checkpoint = _top_nodes;
+    _footer = state.lookup( "footer" );
+    AllowGenerateID *root = dynamic_cast<AllowGenerateID*>(_root_node);
+    if ( root ){
+      map<string,int> counters;
+      for ( const auto& [tag,count] : getArgs( state.lookup( "id_counters" ) ) ){
+	counters[tag] = TiCC::stringTo<int>( count );
+      }
+      root->set_id_counters( counters );
+    }
+    _out_doc->_orig_ann_default_sets.clear();
+    for ( const auto& [type,set] : getArgs( state.lookup( "default_sets" ) ) ){
+      _out_doc->_orig_ann_default_sets[stringToAnnotationType( type )] = set;
+    }
+    _out_doc->_orig_ann_default_procs.clear();
+    for ( const auto& [type,proc] : getArgs( state.lookup( "default_processors" ) ) ){
+      _out_doc->_orig_ann_default_procs[stringToAnnotationType( type )] = proc;
     }
   }
 
+  const string CHECKPOINT_MAGIC = "FoLiA-checkpoint 1";
+
+  void Engine::write_checkpoint(){
+    /// output all complete nodes, and save the state in the checkpoint file
+    if ( _debug ){
+      DBG << "Engine::write_checkpoint() at top node " << _top_nodes << endl;
+    }
+    flush();
+    // all nodes are gone, so the next one goes directly below the root
+    _current_node = _root_node;
+    _last_added = 0;
+    _last_depth = 2;
+    _os->flush();
+    KWargs state;
+    state.add( "output_bytes",
+	       TiCC::toString( static_cast<long long>(_os->tellp()) ) );
+    save_state( state );
+    // write a new file, and replace the old one in one go
+    const string tmp_name = _checkpoint_file + ".tmp";
+    ofstream os( tmp_name, ios::binary );
+    os << CHECKPOINT_MAGIC << "\n";
+    for ( const auto& [key,value] : state ){
+      os << key << " " << value.size() << "\n" << value << "\n";
+    }
+    os.close();
+    if ( !os
+	 || rename( tmp_name.c_str(), _checkpoint_file.c_str() ) != 0 ){
+      throw runtime_error( "folia::Engine: unable to write checkpoint '"
+			   + _checkpoint_file + "'" );
+    }
+    _last_checkpoint = _top_nodes;
+  }
+
+  static KWargs read_checkpoint( istream& is, const string& name ){
+    /// read the values from a checkpoint file
+    string line;
+    if ( !getline( is, line ) || line != CHECKPOINT_MAGIC ){
+      throw runtime_error( "folia::Engine::resume(): '" + name
+			   + "' is not a checkpoint file" );
+    }
+    KWargs result;
+    while ( getline( is, line ) ){
+      size_t space = line.find( ' ' );
+      size_t length = 0;
+      if ( space == string::npos
+	   || !TiCC::stringTo( line.substr( space+1 ), length ) ){
+	throw runtime_error( "folia::Engine::resume(): '" + name
+			     + "' is corrupt" );
+      }
+      string value( length, '\0' );
+      is.read( &value[0], length );
+      if ( static_cast<size_t>(is.gcount()) != length
+	   || is.get() != '\n' ){
+	throw runtime_error( "folia::Engine::resume(): '" + name
+			     + "' is truncated" );
+      }
+      result.add( line.substr( 0, space ), value );
+    }
+    for ( const auto& key : { "every", "top_nodes", "output_bytes",
+			      "footer", "prologue" } ){
+      if ( !result.is_present( key ) ){
+	throw runtime_error( "folia::Engine::resume(): '" + name
+			     + "' lacks " + key );
+      }
+    }
+    return result;
+  }
+
+  bool Engine::resume( const string& in_name,
+		       const string& out_name,
+		       const string& checkpoint ){
+    /// initialize the Engine from a checkpoint, to continue an interrupted
+    /// run
+    /*!
+      \param in_name the input file of the interrupted run
+      \param out_name its output file
+      \param checkpoint the checkpoint file it wrote
+      \return false when there is no checkpoint file. Nothing is done then,
+      so init_doc() can be used to start from scratch
+
+      The Document is rebuilt from the header as it was at the checkpoint,
+      so with all declarations, provenance and metadata. The output file is
+      cut back to its size at the checkpoint, and the input is skipped upto
+      the first top level node that wasn't complete. Checkpoints are
+      written again, to the same file and with the same interval.
+
+      The other settings, like the auto-flush policy, are not stored. When
+      the interrupted run used the same ones, and the processing itself is
+      deterministic, the output is the same as that of an uninterrupted run.
+      With the BYTE_BUDGET policy, the flushing moments may differ, and so
+      may the layout of the output.
+    */
+    ifstream is( checkpoint, ios::binary );
+    if ( !is ){
+      return false;
+    }
+    if ( _out_doc ){
+      throw logic_error( "folia::Engine::resume() on an initialized Engine" );
+    }
+    KWargs state = read_checkpoint( is, checkpoint );
+    const string header = state["prologue"] + state["footer"];
+    Engine::init_doc( header );
+    _out_doc->_source_name = in_name;
+    xmlFreeTextReader( _reader );
+    _reader = create_text_reader( in_name );
+    if ( _reader == 0 ){
+      throw runtime_error( "folia::Engine::resume() failed on '" + in_name
+			   + "' (File not found)" );
+    }
+    // position the reader at the <text> or <speech> node, like init_doc()
+    int index = 0;
+    bool found = false;
+    while ( !found && xmlTextReaderRead(_reader) > 0 ){
+      if ( xmlTextReaderNodeType(_reader) == XML_READER_TYPE_ELEMENT ){
+	++index;
+	string_view local = to_string_view(xmlTextReaderConstLocalName(_reader));
+	found = ( local == "text" || local == "speech" );
+      }
+    }
+    if ( !found ){
+      throw runtime_error( "folia::Engine::resume(): no <text> or <speech> in '"
+			   + in_name + "'" );
+    }
+    _start_index = index;
+    restore_state( state );
+    // skip the top level nodes that are output already
+    size_t seen = 0;
+    int ret = xmlTextReaderRead(_reader);
+    while ( ret == 1 && xmlTextReaderDepth(_reader) >= 2 ){
+      if ( xmlTextReaderNodeType(_reader) == XML_READER_TYPE_ELEMENT ){
+	if ( seen == _top_nodes ){
+	  break;
+	}
+	++seen;
+      }
+      ret = xmlTextReaderNext(_reader);
+    }
+    if ( ret != 1 || seen != _top_nodes ){
+      throw runtime_error( "folia::Engine::resume(): the checkpoint doesn't fit '"
+			   + in_name + "'" );
+    }
+    _at_resume_node = true;
+    // cut back the output
+    const long long bytes = TiCC::stringTo<long long>( state["output_bytes"] );
+    struct stat st;
+    if ( stat( out_name.c_str(), &st ) != 0
+	 || st.st_size < bytes
+	 || truncate( out_name.c_str(), bytes ) != 0 ){
+      throw runtime_error( "folia::Engine::resume(): the output file '"
+			   + out_name + "' is missing or too short" );
+    }
+    _os = new ofstream( out_name, ios::in | ios::out | ios::binary );
+    _os->seekp( 0, ios::end );
+    _out_name = out_name;
+    _header_done = true;
+    _out_doc->freeze_declarations( true );
+    _checkpoint_file = checkpoint;
+    return true;
+  }
+
   void Engine::finish() {
     /// finalize the Engine bij calling output_footer
     if ( _debug ){
@@ -1177,6 +2670,66 @@ namespace folia {
     return Engine::init_doc( i, o );
   }
 
+  TextEngine::~TextEngine(){
+    /// destructor
+    delete _spool;
+  }
+
+  bool TextEngine::init_doc( const read_function& reader,
+			     const string& o ){
+    /// init an associated document for this TextEngine, reading from a
+    /// function
+    /*!
+      \param reader the function which delivers the input, see
+      Engine::init_doc( const read_function&, const string& )
+      \param o when not empty, add an output-file with this name
+
+      A TextEngine reads its input twice: once to find the text parents,
+      and once to return them. So the input is first copied to a temporary
+      file, which is removed again by the destructor
+    */
+    delete _spool;
+    _spool = new TiCC::tmp_stream( "folia-engine", false );
+    ofstream& os = _spool->os();
+    char block[65536];
+    int n;
+    while ( ( n = reader( block, sizeof(block) ) ) > 0 ){
+      os.write( block, n );
+    }
+    _spool->close();
+    if ( n < 0 || !os ){
+      throw runtime_error( "folia::TextEngine(), unable to copy the input stream" );
+    }
+    return TextEngine::init_doc( _spool->tmp_name(), o );
+  }
+
+  bool TextEngine::resume( const string& i,
+			   const string& o,
+			   const string& checkpoint ){
+    /// continue an interrupted run of this TextEngine. See Engine::resume()
+    /*!
+      A call to setup() is still needed, with the same arguments as in
+      the interrupted run
+    */
+    _in_file = i;
+    _is_setup = false;
+    return Engine::resume( i, o, checkpoint );
+  }
+
+  void TextEngine::save_state( KWargs& state ) const {
+    /// add the position in the text parent map to a checkpoint
+    Engine::save_state( state );
+    state.add( "node_count", TiCC::toString( _node_count ) );
+    state.add( "next_text_node", TiCC::toString( _next_text_node ) );
+  }
+
+  void TextEngine::restore_state( const KWargs& state ){
+    /// restore the values from a checkpoint, see save_state()
+    Engine::restore_state( state );
+    _resume_node_count = TiCC::stringTo<int>( state.lookup( "node_count" ) );
+    _resume_text_node = TiCC::stringTo<int>( state.lookup( "next_text_node" ) );
+  }
+
   void TextEngine::setup( const string& textclass, bool prefer_struct ){
     /// set the TextEngine ready for parsing
     /*!
@@ -1195,6 +2748,11 @@ namespace folia {
       _next_text_node = text_parent_map.begin()->first;
     }
     _node_count = _start_index;
+    if ( _resume_node_count >= 0 ){
+      // continue where the checkpoint was made
+      _node_count = _resume_node_count;
+      _next_text_node = _resume_text_node;
+    }
     _is_setup = true;
   }
 
@@ -1374,6 +2932,10 @@ namespace folia {
     if ( !_is_setup ){
       throw runtime_error( "TextEngine: not setup yet!" );
     }
+    if ( _raw ){
+      throw logic_error( "TextEngine: impossible in passthrough mode" );
+    }
+    auto_flush();
     if ( text_parent_map.empty() ){
       if ( _debug ){
 	DBG << "next_text_parent(). the parent map is empty." << endl;
@@ -1382,7 +2944,12 @@ namespace folia {
     }
 
     int ret = 0;
-    if ( _external_node != 0 ){
+    if ( _at_resume_node ){
+      // resume() has positioned the reader
+      _at_resume_node = false;
+      ret = 1;
+    }
+    else if ( _external_node != 0 ){
       // so our last action was to output a pointer to a subtree.
       // continue with the next node, avoiding this subtree
       _external_node = 0;
@@ -1413,6 +2980,9 @@ namespace folia {
 	if ( _debug ){
 	  DBG << "next element: " << local_name << " cnt =" << _node_count << endl;
 	}
+	if ( new_depth == 2 ){
+	  top_node_start();
+	}
 	if ( _node_count == _next_text_node  ){
 	  // HIT!
 	  if ( _debug ){
@@ -43,6 +43,7 @@
 #include "ticcutils/Unicode.h"
 #include "libfolia/folia.h"
 #include "libfolia/folia_properties.h"
+#include "folia_counters.h"
 #include "config.h"
 
 using namespace std;
@@ -114,12 +115,12 @@ namespace folia {
     return _props.ANNOTATIONTYPE;
   }
 
-  const set<ElementType>& AbstractElement::accepted_data() const {
+  const ElementTypeSet& AbstractElement::accepted_data() const {
     /// return the ACCEPTED_DATA property
     return _props.ACCEPTED_DATA;
   }
 
-  const set<ElementType>& AbstractElement::required_data() const {
+  const ElementTypeSet& AbstractElement::required_data() const {
     /// return the REQUIRED_DATA property
     return _props.REQUIRED_DATA;
   }
@@ -282,8 +283,11 @@ namespace folia {
     _line_no(-1),
     _confidence(-1),
     _preserve_spaces(SPACE_FLAGS::UNSET),
+    _counts_stale(false),
+    _deferred(0),
     _props(p)
   {
+    FOLIA_COUNT( d, Counter::ELEMENTS_CREATED, 1 );
     if ( d && d->debug % DocDbg::MEMORY ){
       dbg( "AbstractElement::created" );
     }
@@ -347,11 +351,18 @@ namespace folia {
     if ( doc() && doc()->debug % DocDbg::MEMORY ){
       DBG << "object has " << _data.size() << " children" << endl;
     }
+    // children that were never parsed don't need destruction
+    delete _deferred;
+    _deferred = 0;
+    if ( doc() ){
+      doc()->forget_postponed( this );
+    }
     for ( const auto& el : _data ) {
       el->set_parent(0);
       el->destroy();
     }
     _data.clear();
+    _child_counts.clear();
     if ( doc() && doc()->debug % DocDbg::MEMORY ){
       dbg( "\tfinished destroying element" );
       DBG << "\t id=" << _id << " class= " << cls()
@@ -360,6 +371,38 @@ namespace folia {
     delete this;
   }
 
+  void AbstractElement::set_deferred( DeferredSubtree *src ){
+    /// postpone the parsing of the children of this node
+    /*!
+     * \param src the source of the children. We take ownership.
+     */
+    if ( !_data.empty() ){
+      throw logic_error( "set_deferred(): node <" + xmltag()
+			 + "> already has children" );
+    }
+    delete _deferred;
+    _deferred = src;
+  }
+
+  void AbstractElement::expand_deferred() const {
+    /// parse the postponed children of this node
+    /*!
+     * The DeferredSubtree is released before parsing, so the normal append()
+     * machinery can be used on this node while expanding.
+     */
+    DeferredSubtree *src = _deferred;
+    _deferred = 0;
+    AbstractElement *me = const_cast<AbstractElement*>(this);
+    try {
+      src->expand( me );
+    }
+    catch ( ... ){
+      delete src;
+      throw;
+    }
+    delete src;
+  }
+
   void destroy( FoliaElement *el ){
     if ( el ){
       el->destroy();
@@ -396,6 +439,10 @@ namespace folia {
     if ( _mydoc ){
       string def;
       if ( !_set.empty() ){
+	if ( _mydoc->trusted_input() ){
+	  // restoring a snapshot of a Document that was already checked
+	  return;
+	}
 	if ( !doc()->declared( annotation_type(), _set ) ) {
 	  throw DeclarationError( this,
 				  "Set '" + _set
@@ -423,11 +470,15 @@ namespace folia {
 	}
 	if ( !def.empty() ){
 	  _set = def;
+	  invalidate_parent_counts();
 	}
 	else if ( required_attributes() % Attrib::CLASS ){
 	  throw XmlError( this,
 			  "unable to assign a default set for tag: " + xmltag() );
 	}
+	if ( _mydoc->trusted_input() ){
+	  return;
+	}
       }
       if ( annotation_type() != AnnotationType::NO_ANN
 	   && !_mydoc->version_below( 2, 0 ) ){
@@ -1095,9 +1146,13 @@ namespace folia {
 	  throw;
 	}
       }
-      doc()->setdebug( doc_dbg );
+      if ( att_dbg ){
+	// restore the debug level we switched off above
+	doc()->setdebug( doc_dbg );
+      }
     }
     kwargs.erase("typegroup"); //this is used in explicit form only, we can safely discard it
+    invalidate_parent_counts();
     addFeatureNodes( kwargs );
   }
 
@@ -1939,6 +1994,7 @@ namespace folia {
      * \param kanon Output in a canonical form to make comparions easy
      * \return am xmlNode object(-tree)
      */
+    materialize();
     xmlNode *e = XmlNewNode( foliaNs(), xmltag() );
     KWargs attribs = collectAttributes();
     if ( _preserve_spaces == SPACE_FLAGS::PRESERVE ){
@@ -2181,6 +2237,7 @@ namespace folia {
      * When this test fails, an empty string is returned, UNLESS the element has
      * the SPACE attribute AND retaintok is specified
      */
+    materialize();
     bool retaintok  = tp.is_set( TEXT_FLAGS::RETAIN );
     if ( tp.debug() ){
       DBG << "IN <" << xmltag() << ">:get_delimiter (" << retaintok << ")"
@@ -2243,6 +2300,7 @@ namespace folia {
   }
 
   UnicodeString AbstractElement::text_container_text( const TextPolicy& tp ) const {
+    materialize();
     string desired_class = tp.get_class();
     if ( isinstance<TextContent>()
 	 && cls() != desired_class ) {
@@ -2444,6 +2502,7 @@ namespace folia {
     /*!
      * \param tp a TextPolicy
      */
+    FOLIA_COUNT( doc(), Counter::TEXT_CALLS, 1 );
     if ( tp.debug() ){
       DBG << "DEBUG <" << xmltag() << ">.text() Policy=" << tp << endl;
     }
@@ -2459,6 +2518,7 @@ namespace folia {
      * \param flags the search parameters to use. See TEXT_FLAGS.
      * \param txt_dbg enables debugging when true
      */
+    FOLIA_COUNT( doc(), Counter::TEXT_CALLS, 1 );
     TextPolicy tp( cls, flags );
     tp.set_debug( txt_dbg );
     if ( txt_dbg ){
@@ -2724,6 +2784,7 @@ namespace folia {
      * \return The Unicode Text found.
      * Will throw on error.
      */
+    materialize();
     if ( tp.debug() ){
       DBG << "deeptext, policy: " << tp << ", on node : <" << xmltag()
 	   << " id=" << id() << ", cls=" << this->cls() << ">" << endl;
@@ -2844,6 +2905,7 @@ namespace folia {
      * might throw NoSuchText exception if not found.
      */
 
+    materialize();
     if ( tp.debug() ){
       DBG << "text_content, policy= " << tp << endl;
     }
@@ -2934,6 +2996,7 @@ namespace folia {
      * Does not recurse into children with the sole exception of Correction
      * might throw NoSuchPhon exception if not found.
      */
+    materialize();
     string desired_class = tp.get_class();
     if ( isinstance<PhonContent>() ){
       if  ( cls() == desired_class ){
@@ -3045,6 +3108,7 @@ namespace folia {
      * \return The Unicode Text found.
      * Will throw on error.
      */
+    materialize();
     if ( tp.debug() ){
       DBG << "deepPHON, policy= " << tp << ", on node : " << xmltag()
 	   << " id=" << id() << endl;
@@ -3161,6 +3225,7 @@ namespace folia {
      *
      * when not found this function does nothing and returns 0
      */
+    materialize();
     FoliaElement *result = 0;
     auto it = find_if( _data.begin(),
 		       _data.end(),
@@ -3169,6 +3234,8 @@ namespace folia {
       *it = _new;
       result = old;
       _new->set_parent(this);
+      count_child( old, -1 );
+      count_child( _new, 1 );
     }
     return result;
   }
@@ -3181,10 +3248,12 @@ namespace folia {
      *
      * throws when pos is not found
      */
+    materialize();
     auto it = _data.begin();
     while ( it != _data.end() ) {
       if ( *it == pos ) {
 	it = _data.insert( ++it, add );
+	count_child( add, 1 );
 	break;
       }
       ++it;
@@ -3222,19 +3291,10 @@ namespace folia {
      * \param t the ElementType to test
      *
      * This function tests if t is in the accepted_data list of the node
-     * OR if it is a SubClass of one of the accepted types
+     * OR if it is a SubClass of one of the accepted types.
+     * This is a lookup in a table precomputed by static_init()
      */
-
-    auto it = accepted_data().find( t );
-    if ( it != accepted_data().end() ) {
-      return true;
-    }
-    else {
-      return any_of( accepted_data().cbegin(),
-		     accepted_data().cend(),
-		     [t]( const ElementType& et) {
-		       return ( folia::is_subtype( t, et ) ); } );
-    }
+    return folia::is_acceptable( element_id(), t );
   }
 
   bool AbstractElement::addable( const FoliaElement *parent ) const {
@@ -3254,9 +3314,7 @@ namespace folia {
       throw ValueError( this, mess );
     }
     if ( occurrences() > 0 ) {
-      vector<FoliaElement*> v = parent->select( element_id(),
-						SELECT_FLAGS::LOCAL );
-      size_t count = v.size();
+      size_t count = parent->count_children( element_id() );
       if ( count >= occurrences() ) {
 	string mess = "Unable to add another object of type " + classname()
 	  + " to " + parent->classname() + ". There are already "
@@ -3267,10 +3325,7 @@ namespace folia {
     }
     if ( occurrences_per_set() > 0 &&
 	 ( ( required_attributes() % Attrib::CLASS ) || setonly() ) ){
-      vector<FoliaElement*> v = select( element_id(),
-					sett(),
-					SELECT_FLAGS::LOCAL );
-      size_t count = v.size();
+      size_t count = count_children( element_id(), sett() );
       if ( count >= occurrences_per_set() ) {
 	string mess = "Unable to add another object of type " + classname()
 	  + " to " + parent->classname() + ". There are already "
@@ -3324,19 +3379,13 @@ namespace folia {
       }
     }
     if ( isinstance<TextContent>() ){
-      string my_cls = cls();
-      string st = sett();
-      vector<TextContent*> tmp = parent->select<TextContent>( st,
-							      SELECT_FLAGS::LOCAL );
-      if ( any_of( tmp.cbegin(),
-		   tmp.cend(),
-		   [my_cls]( const TextContent *t) { return ( t->cls() == my_cls);} ) ){
+      if ( parent->has_text_class( sett(), cls() ) ){
 	throw DuplicateAnnotationError( this,
 					"attempt to add <t> with class="
-					+ my_cls + " to element: "
+					+ cls() + " to element: "
 					+ parent->id()
 					+ " which already has a <t> with that class" );
-	}
+      }
     }
     if ( is_textcontainer() ||
 	 isinstance<Word>() ){
@@ -3362,6 +3411,7 @@ namespace folia {
      */
     if ( !_mydoc ) {
       _mydoc = the_doc;
+      FOLIA_COUNT( the_doc, Counter::ELEMENTS_CREATED, 1 );
       if ( annotation_type() != AnnotationType::NO_ANN
 	   && !the_doc->version_below( 2, 0 )
 	   && !the_doc->declared( annotation_type() ) ){
@@ -3515,6 +3565,7 @@ namespace folia {
      *
      * will throw on error
      */
+    materialize();
     if ( !child ){
       throw XmlError( this,
 		      "attempt to append an empty node to a " + classname() );
@@ -3538,6 +3589,7 @@ namespace folia {
 	child->assignDoc( doc() );
       }
       _data.push_back(child);
+      count_child( child, 1 );
       if ( !child->parent() ) {
 	child->set_parent(this);
       }
@@ -3567,15 +3619,128 @@ namespace folia {
     /*!
      * \param child the element to remove
      */
+    materialize();
     if ( doc() && doc()->debug % DocDbg::MEMORY ){
       DBG << "\nremove " << child->xmltag();
       dbg( " from" );
       DBG << " id=" << _id << " class= " << endl;
     }
     auto it = std::remove( _data.begin(), _data.end(), child );
+    for ( auto rit = it; rit != _data.end(); ++rit ){
+      count_child( child, -1 );
+    }
     _data.erase( it, _data.end() );
   }
 
+  void AbstractElement::count_child( const FoliaElement *child,
+				     int delta ) const {
+    /// update the child counters after adding or removing a child
+    /*!
+     * \param child the node that was added or removed
+     * \param delta 1 for an addition, -1 for a removal
+     *
+     * When the counters turn out to be inconsistent, they are marked stale
+     * and rebuilt on the next lookup
+     */
+    if ( _counts_stale ){
+      return;
+    }
+    static const string no_class;
+    const string& c_cls = child->isinstance<TextContent>() ? child->cls()
+      : no_class;
+    for ( auto& cc : _child_counts ){
+      if ( cc.type == child->element_id()
+	   && cc.set == child->sett()
+	   && cc.cls == c_cls ){
+	if ( delta > 0 ){
+	  ++cc.count;
+	}
+	else if ( cc.count > 0 ){
+	  --cc.count;
+	}
+	else {
+	  _counts_stale = true;
+	}
+	return;
+      }
+    }
+    if ( delta > 0 ){
+      _child_counts.push_back( { child->element_id(),
+				 child->sett(),
+				 c_cls,
+				 1 } );
+    }
+    else {
+      _counts_stale = true;
+    }
+  }
+
+  void AbstractElement::recount_children() const {
+    /// rebuild the child counters from scratch
+    _child_counts.clear();
+    _counts_stale = false;
+    for ( const auto& el : _data ){
+      count_child( el, 1 );
+    }
+  }
+
+  void AbstractElement::invalidate_parent_counts(){
+    /// mark the child counters of our parent as stale
+    /*!
+     * called when our set or class changes, after we were appended
+     */
+    auto *ae = dynamic_cast<AbstractElement*>( _parent );
+    if ( ae ){
+      ae->_counts_stale = true;
+    }
+  }
+
+  size_t AbstractElement::count_children( ElementType et,
+					  const string& st ) const {
+    /// count the direct children of a certain type
+    /*!
+     * \param et the ElementType to count
+     * \param st when not empty, only count children with this set
+     * \return the number of matching children
+     *
+     * Equivalent to select( et, st, LOCAL ).size(), but it uses the
+     * counters maintained by append() and remove(), so it doesn't
+     * depend on the number of children
+     */
+    materialize();
+    if ( _counts_stale ){
+      recount_children();
+    }
+    size_t result = 0;
+    for ( const auto& cc : _child_counts ){
+      if ( cc.type == et
+	   && ( st.empty() || cc.set == st ) ){
+	result += cc.count;
+      }
+    }
+    return result;
+  }
+
+  bool AbstractElement::has_text_class( const string& st,
+					const string& text_cls ) const {
+    /// check for a direct TextContent child with the given set and class
+    /*!
+     * \param st when not empty, the set to match
+     * \param text_cls the textclass to match
+     */
+    materialize();
+    if ( _counts_stale ){
+      recount_children();
+    }
+    return any_of( _child_counts.begin(),
+		   _child_counts.end(),
+		   [&]( const child_count& cc ){
+		     return cc.type == ElementType::TextContent_t
+		       && cc.count > 0
+		       && ( st.empty() || cc.set == st )
+		       && cc.cls == text_cls; } );
+  }
+
   FoliaElement* AbstractElement::index( size_t i ) const {
     /// return the child at index i
     /*!
@@ -3584,6 +3749,7 @@ namespace folia {
      *
      * Will throw when the index is out of range
      */
+    materialize();
     if ( i < _data.size() ) {
       return _data[i];
     }
@@ -3598,6 +3764,7 @@ namespace folia {
      *
      * Will throw when the index is out of range
      */
+    materialize();
     if ( i < _data.size() ) {
       while ( _data[i]->isinstance<XmlComment>()
 	      && ++i < _data.size() );
@@ -3614,6 +3781,7 @@ namespace folia {
      *
      * Will throw when the index is out of range
      */
+    materialize();
     if ( ri < _data.size() ) {
       return _data[_data.size()-1-ri];
     }
@@ -3639,6 +3807,9 @@ namespace folia {
      *     - TOP_HIT : like recurse, but do NOT recurse into sibblings
      *               of matching node
      */
+    materialize();
+    FOLIA_COUNT( doc(), Counter::SELECT_CALLS, 1 );
+    FOLIA_COUNT( doc(), Counter::NODES_VISITED, _data.size() );
     vector<FoliaElement*> res;
     for ( const auto& el : _data ) {
       if ( el->element_id() == et &&
@@ -3681,6 +3852,9 @@ namespace folia {
      * \return An ordered vector of FoLiAElement nodes that match the conditions
      *
      */
+    materialize();
+    FOLIA_COUNT( doc(), Counter::SELECT_CALLS, 1 );
+    FOLIA_COUNT( doc(), Counter::NODES_VISITED, _data.size() );
     vector<FoliaElement*> res;
     for ( const auto& el : _data ) {
       if ( elts.find(el->element_id()) != elts.end() &&
@@ -3749,6 +3923,7 @@ namespace folia {
       (*dit)->unravel( store );
       dit = _data.erase(dit);
     }
+    _child_counts.clear();
   }
 
   FoliaElement* AbstractElement::parseXml( const xmlNode *node ) {
@@ -3767,6 +3942,21 @@ namespace folia {
     }
     setAttributes( atts );
     set_line_number( xmlGetLineNo(node) );
+    if ( doc() && doc()->defer_subtree( this, node ) ){
+      return this;
+    }
+    parse_children( node );
+    return this;
+  }
+
+  void AbstractElement::parse_children( const xmlNode *node ) {
+    /// parse the children of node and append them to this element
+    /*!
+     * \param node the xmlNode that holds the children
+     *
+     * After parsing, the text consistency of the node is checked, when the
+     * Document requires it.
+     */
     const xmlNode *p = node->children;
     while ( p ) {
       set_line_number( xmlGetLineNo(p) );
@@ -3781,7 +3971,7 @@ namespace folia {
 	continue;
       }
       if ( p->type == XML_ELEMENT_NODE ) {
-	string xml_tag = Name( p );
+	string_view xml_tag = to_string_view( p->name );
 	FoliaElement *t = 0;
 	try {
 	  t = createElement( xml_tag, doc() );
@@ -3789,7 +3979,7 @@ namespace folia {
 	catch ( const exception& e ){
 	  if ( doc() && !doc()->permissive() ){
 	    throw XmlError( this,
-			    string( "parsing <" ) + xml_tag + "> failed:\n\t"
+			    "parsing <" + string( xml_tag ) + "> failed:\n\t"
 			    + e.what() );
 	  }
 	}
@@ -3897,13 +4087,23 @@ namespace folia {
       }
       p = p->next;
     }
+    if ( doc() && doc()->postpone_checks( this ) ){
+      // some children are deferred. The Document will call
+      // check_after_parsing() when they are all expanded
+      return;
+    }
+    check_after_parsing();
+  }
+
+  void AbstractElement::check_after_parsing() {
+    /// check the text consistency of a freshly parsed node
     if ( doc() && ( doc()->checktext() || doc()->fixtext() )
 	 && this->printable()
 	 && !isSubClass<Morpheme>() && !isSubClass<Phoneme>() ){
+      PhaseTimer timer( doc()->metrics(), Phase::TEXT_CHECKS );
       check_text_consistency_while_parsing( true,
 					    doc()->debug % DocDbg::TEXTHANDLING );
     }
-    return this;
   }
 
   void AbstractElement::setDateTime( const string& s ) {
@@ -4611,6 +4811,7 @@ namespace folia {
      * \param s a subset name
      * \return the first class of the first Feature node in subset s
      */
+    materialize();
     const auto& it = find_if( _data.begin(), _data.end(),
 			      [s]( const FoliaElement *e ){
 				return ( e->isSubClass<AbstractFeature>()
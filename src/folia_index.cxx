@@ -0,0 +1,381 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of libfolia
+
+  libfolia is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  libfolia is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+/** @file folia_index.cxx */
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "ticcutils/StringOps.h"
+#include "libfolia/folia.h"
+#include "libfolia/folia_binary.h"
+#include "libfolia/folia_index.h"
+#include "folia_raw_input.h"
+
+using namespace std;
+
+namespace folia {
+
+  const char INDEX_MAGIC[8] = { 'F', 'o', 'L', 'i', 'A', 'i', 'd', 'x' };
+  const uint32_t INDEX_BYTE_ORDER_MARK = 0x01020304;
+
+  static void file_stat( const string& name,
+			 uint64_t& size,
+			 uint64_t& time ){
+    /// get the size and the modification time of a file
+    struct stat st;
+    if ( stat( name.c_str(), &st ) != 0 ){
+      throw IndexError( "unable to open '" + name + "'" );
+    }
+    size = st.st_size;
+    time = st.st_mtime;
+  }
+
+  static string attribute_value( const string& tag,
+				 const string& att ){
+    /// return the value of attribute att in a raw start tag, or ""
+    size_t pos = tag.find( att );
+    while ( pos != string::npos ){
+      size_t p = pos + att.size();
+      if ( pos > 0 && isspace( static_cast<unsigned char>(tag[pos-1]) ) ){
+	while ( p < tag.size() && isspace( static_cast<unsigned char>(tag[p]) ) ){
+	  ++p;
+	}
+	if ( p < tag.size() && tag[p] == '=' ){
+	  ++p;
+	  while ( p < tag.size() && isspace( static_cast<unsigned char>(tag[p]) ) ){
+	    ++p;
+	  }
+	  if ( p < tag.size() && ( tag[p] == '"' || tag[p] == '\'' ) ){
+	    size_t end = tag.find( tag[p], p+1 );
+	    if ( end != string::npos ){
+	      return tag.substr( p+1, end-p-1 );
+	    }
+	  }
+	}
+      }
+      pos = tag.find( att, pos+1 );
+    }
+    return "";
+  }
+
+  static string read_range( istream& is,
+			    uint64_t offset,
+			    uint64_t length ){
+    /// read length bytes at offset from a stream
+    is.seekg( offset );
+    string result( length, '\0' );
+    is.read( &result[0], length );
+    if ( static_cast<uint64_t>(is.gcount()) != length ){
+      throw IndexError( "the indexed file is shorter than expected" );
+    }
+    return result;
+  }
+
+  void DocumentIndex::build( const string& file_name ){
+    /// scan a FoLiA XML file, and index all elements in the body that have
+    /// an xml:id
+    /*!
+      \param file_name the file to index. It can't be compressed.
+
+      The file is read once, and is not parsed into a Document, so this is
+      fast and takes little memory. It is NOT validated either, use a
+      Document for that.
+    */
+    if ( TiCC::match_back( file_name, ".bz2" )
+	 || TiCC::match_back( file_name, ".gz" ) ){
+      throw IndexError( "unable to index a compressed file: " + file_name );
+    }
+    _source = file_name;
+    file_stat( _source, _source_size, _source_time );
+    _root_name.clear();
+    _entries.clear();
+    _ids.clear();
+    raw_input in( new ifstream( _source, ios::binary ) );
+    // find the root and the <text> or <speech> node, which is a child
+    int depth = 0;
+    while ( true ){
+      in.pass_text();
+      raw_input::token t = in.pass_token();
+      if ( t == raw_input::token::NONE ){
+	throw IndexError( _source + ": no <text> or <speech> found" );
+      }
+      if ( t == raw_input::token::END ){
+	--depth;
+      }
+      else if ( t == raw_input::token::START ){
+	if ( depth == 0 ){
+	  _root_name = in.name();
+	}
+	else if ( depth == 1 ){
+	  string local = in.name().substr( in.name().find( ':' ) + 1 );
+	  if ( local == "text" || local == "speech" ){
+	    break;
+	  }
+	}
+	++depth;
+      }
+    }
+    struct open_node {
+      uint32_t entry;  // NO_PARENT when it has no entry (yet)
+      uint64_t offset;
+      uint32_t tag_length;
+    };
+    vector<open_node> open;
+    uint32_t tag_length = in.tag().size();
+    open.push_back( { 0, in.position() - tag_length, tag_length } );
+    _entries.push_back( { open[0].offset, 0, tag_length, NO_PARENT } );
+    string root_id = attribute_value( in.tag(), "xml:id" );
+    if ( !root_id.empty() ){
+      _ids[root_id] = 0;
+    }
+    while ( !open.empty() ){
+      in.pass_text();
+      uint64_t start = in.position();
+      raw_input::token t = in.pass_token();
+      switch ( t ){
+      case raw_input::token::NONE:
+	throw IndexError( _source + ": unexpected end of file" );
+      case raw_input::token::START:
+      case raw_input::token::EMPTY: {
+	tag_length = in.position() - start;
+	uint32_t number = NO_PARENT;
+	string id = attribute_value( in.tag(), "xml:id" );
+	if ( !id.empty() ){
+	  if ( _entries.size() + open.size() >= NO_PARENT ){
+	    throw IndexError( _source + ": too many elements to index" );
+	  }
+	  // make sure all ancestors have an entry
+	  for ( size_t i=1; i < open.size(); ++i ){
+	    if ( open[i].entry == NO_PARENT ){
+	      open[i].entry = _entries.size();
+	      _entries.push_back( { open[i].offset, 0, open[i].tag_length,
+				    open[i-1].entry } );
+	    }
+	  }
+	  number = _entries.size();
+	  _entries.push_back( { start, tag_length, tag_length,
+				open.back().entry } );
+	  if ( !_ids.emplace( id, number ).second ){
+	    throw DuplicateIDError( id );
+	  }
+	}
+	if ( t == raw_input::token::START ){
+	  open.push_back( { number, start, tag_length } );
+	}
+      }
+	break;
+      case raw_input::token::END:
+	if ( open.back().entry != NO_PARENT ){
+	  _entries[open.back().entry].length
+	    = in.position() - open.back().offset;
+	}
+	open.pop_back();
+	break;
+      default:
+	break;
+      }
+    }
+  }
+
+  void DocumentIndex::save( const string& file_name ) const {
+    /// write the index to a file
+    /*!
+      \param file_name the name of the index file
+    */
+    if ( _entries.empty() ){
+      throw logic_error( "DocumentIndex::save() on an empty index" );
+    }
+    string out( INDEX_MAGIC, sizeof(INDEX_MAGIC) );
+    binary::put_u32( out, FORMAT_VERSION );
+    binary::put_u32( out, INDEX_BYTE_ORDER_MARK );
+    binary::put_u64( out, _source_size );
+    binary::put_u64( out, _source_time );
+    binary::put_u32( out, _root_name.size() );
+    out += _root_name;
+    binary::put_u32( out, _entries.size() );
+    for ( const auto& e : _entries ){
+      binary::put_u64( out, e.offset );
+      binary::put_u64( out, e.length );
+      binary::put_u32( out, e.tag_length );
+      binary::put_u32( out, e.parent );
+    }
+    binary::put_u32( out, _ids.size() );
+    for ( const auto& [id,number] : _ids ){
+      binary::put_u32( out, id.size() );
+      out += id;
+      binary::put_u32( out, number );
+    }
+    ofstream os( file_name, ios::binary );
+    os.write( out.data(), out.size() );
+    if ( !os ){
+      throw IndexError( "unable to write '" + file_name + "'" );
+    }
+  }
+
+  void DocumentIndex::load( const string& file_name,
+			    const string& index_name ){
+    /// read an index, made by save()
+    /*!
+      \param file_name the indexed FoLiA file
+      \param index_name the name of the index file
+
+      Throws an IndexError when the FoLiA file changed since it was indexed
+    */
+    ifstream is( index_name, ios::binary );
+    if ( !is ){
+      throw IndexError( "unable to open '" + index_name + "'" );
+    }
+    const string buf( (istreambuf_iterator<char>(is)),
+		      istreambuf_iterator<char>() );
+    _source = file_name;
+    _root_name.clear();
+    _entries.clear();
+    _ids.clear();
+    try {
+      binary::Cursor c( buf.data(), buf.size() );
+      c.need( sizeof(INDEX_MAGIC) );
+      if ( memcmp( c.pos, INDEX_MAGIC, sizeof(INDEX_MAGIC) ) != 0 ){
+	throw IndexError( index_name + " is not an index file" );
+      }
+      c.skip( sizeof(INDEX_MAGIC) );
+      if ( c.u32() != FORMAT_VERSION ){
+	throw IndexError( index_name + ": unsupported version" );
+      }
+      if ( c.u32() != INDEX_BYTE_ORDER_MARK ){
+	throw IndexError( index_name + ": written with another byte order" );
+      }
+      _source_size = c.u64();
+      _source_time = c.u64();
+      uint64_t size;
+      uint64_t time;
+      file_stat( _source, size, time );
+      if ( size != _source_size || time != _source_time ){
+	throw IndexError( _source + " changed since it was indexed" );
+      }
+      uint32_t len = c.u32();
+      c.need( len );
+      _root_name.assign( c.pos, len );
+      c.skip( len );
+      uint32_t count = c.u32();
+      _entries.reserve( count );
+      for ( uint32_t i=0; i < count; ++i ){
+	entry e;
+	e.offset = c.u64();
+	e.length = c.u64();
+	e.tag_length = c.u32();
+	e.parent = c.u32();
+	if ( ( i == 0 ) != ( e.parent == NO_PARENT )
+	     || ( i > 0 && e.parent >= i ) ){
+	  throw IndexError( index_name + ": corrupt entry table" );
+	}
+	_entries.push_back( e );
+      }
+      count = c.u32();
+      _ids.reserve( count );
+      for ( uint32_t i=0; i < count; ++i ){
+	len = c.u32();
+	c.need( len );
+	string id( c.pos, len );
+	c.skip( len );
+	uint32_t number = c.u32();
+	if ( number >= _entries.size() ){
+	  throw IndexError( index_name + ": corrupt id table" );
+	}
+	_ids.emplace( id, number );
+      }
+    }
+    catch ( const binary::BinaryFormatError& ){
+      throw IndexError( index_name + ": unexpected end of data" );
+    }
+  }
+
+  bool DocumentIndex::has( const string& id ) const {
+    /// is there an element with this xml:id in the index?
+    return _ids.find( id ) != _ids.end();
+  }
+
+  Document *DocumentIndex::extract( const string& id ) const {
+    /// parse just the element with xml:id id, in its context
+    /*!
+      \param id the xml:id to look up
+      \return a new Document, or 0 when the id is unknown. The caller
+      owns it.
+
+      The Document gets the complete header of the indexed file, so all
+      declarations and metadata, and the ancestors of the element, without
+      their other children. Use the index of the Document to find the
+      element itself. As the ancestors are incomplete, text consistency is
+      not checked. References to elements outside the element (like the
+      \<wref> of an entity to its words) make the parse fail, extract the
+      enclosing sentence then.
+    */
+    auto it = _ids.find( id );
+    if ( it == _ids.end() ){
+      return 0;
+    }
+    vector<uint32_t> chain;
+    for ( uint32_t e = _entries[it->second].parent;
+	  e != NO_PARENT;
+	  e = _entries[e].parent ){
+      chain.push_back( e );
+    }
+    ifstream is( _source, ios::binary );
+    if ( !is ){
+      throw IndexError( "unable to open '" + _source + "'" );
+    }
+    string buffer = read_range( is, 0, _entries[0].offset );
+    vector<string> names;
+    for ( auto e = chain.rbegin(); e != chain.rend(); ++e ){
+      const entry& anc = _entries[*e];
+      string tag = read_range( is, anc.offset, anc.tag_length );
+      names.push_back( tag.substr( 1, tag.find_first_of( " \t\r\n/>" ) - 1 ) );
+      buffer += tag;
+    }
+    const entry& node = _entries[it->second];
+    buffer += read_range( is, node.offset, node.length );
+    for ( auto n = names.rbegin(); n != names.rend(); ++n ){
+      buffer += "</" + *n + ">";
+    }
+    buffer += "</" + _root_name + ">";
+    Document *result = new Document( "mode='nochecktext'" );
+    try {
+      result->read_from_string( buffer );
+    }
+    catch ( ... ){
+      delete result;
+      throw;
+    }
+    return result;
+  }
+
+} // namespace folia
@@ -0,0 +1,237 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of libfolia
+
+  libfolia is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  libfolia is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+/** @file folia_metrics.cxx */
+
+#include <ctime>
+#include <chrono>
+#include <string>
+#include <stdexcept>
+#include <sstream>
+#include "libfolia/folia_metrics.h"
+
+using namespace std;
+
+namespace folia {
+
+  string toString( Phase p ){
+    /// return a printable name for a Phase
+    switch ( p ){
+    case Phase::TOKENIZE:
+      return "xml tokenize";
+    case Phase::BUILD:
+      return "tree build";
+    case Phase::DECLARATIONS:
+      return "declaration checks";
+    case Phase::TEXT_CHECKS:
+      return "text checks";
+    case Phase::SERIALIZE:
+      return "serialization";
+    default:
+      throw logic_error( "toString() on an invalid Phase" );
+    }
+  }
+
+  string toString( Counter c ){
+    /// return a printable name for a Counter
+    switch ( c ){
+    case Counter::ELEMENTS_CREATED:
+      return "elements_created";
+    case Counter::SELECT_CALLS:
+      return "select_calls";
+    case Counter::NODES_VISITED:
+      return "nodes_visited";
+    case Counter::TEXT_CALLS:
+      return "text_calls";
+    case Counter::NO_SUCH_TEXT:
+      return "no_such_text";
+    case Counter::INDEX_LOOKUPS:
+      return "index_lookups";
+    case Counter::DECLARATION_CHECKS:
+      return "declaration_checks";
+    case Counter::BYTES_SERIALIZED:
+      return "bytes_serialized";
+    default:
+      throw logic_error( "toString() on an invalid Counter" );
+    }
+  }
+
+  Metrics::Metrics(){
+    reset();
+  }
+
+  void Metrics::reset(){
+    /// set all times and counts to 0
+    for ( auto& ph : _phases ){
+      ph.wall_ns = 0;
+      ph.cpu_ns = 0;
+      ph.calls = 0;
+    }
+    for ( auto& cnt : _counters ){
+      cnt = 0;
+    }
+  }
+
+  void Metrics::add( Phase p,
+		     uint64_t wall_ns,
+		     uint64_t cpu_ns,
+		     uint64_t calls ){
+    /// add some time to a phase
+    /*!
+      \param p the Phase
+      \param wall_ns the wall time in nanoseconds
+      \param cpu_ns the CPU time in nanoseconds
+      \param calls the number of finished calls to add
+    */
+    phase_time& ph = _phases[static_cast<unsigned int>(p)];
+    ph.wall_ns.fetch_add( wall_ns, memory_order_relaxed );
+    ph.cpu_ns.fetch_add( cpu_ns, memory_order_relaxed );
+    ph.calls.fetch_add( calls, memory_order_relaxed );
+  }
+
+  double Metrics::wall( Phase p ) const {
+    /// the wall time spent in a phase, in seconds
+    return _phases[static_cast<unsigned int>(p)].wall_ns / 1e9;
+  }
+
+  double Metrics::cpu( Phase p ) const {
+    /// the CPU time spent in a phase, in seconds
+    return _phases[static_cast<unsigned int>(p)].cpu_ns / 1e9;
+  }
+
+  uint64_t Metrics::calls( Phase p ) const {
+    /// the number of times a phase was entered
+    return _phases[static_cast<unsigned int>(p)].calls;
+  }
+
+  uint64_t Metrics::counter( Counter c ) const {
+    /// the current value of a Counter
+    return _counters[static_cast<unsigned int>(c)];
+  }
+
+  MetricsSnapshot Metrics::snapshot() const {
+    /// return a copy of all values
+    /*!
+      When other threads are still working on the Document, the values are
+      not guaranteed to be consistent with each other
+    */
+    MetricsSnapshot result;
+    for ( unsigned int i=0; i < PHASE_COUNT; ++i ){
+      Phase p = static_cast<Phase>(i);
+      result.wall[i] = wall( p );
+      result.cpu[i] = cpu( p );
+      result.calls[i] = calls( p );
+    }
+    for ( unsigned int i=0; i < COUNTER_COUNT; ++i ){
+      result.counts[i] = _counters[i];
+    }
+    return result;
+  }
+
+  string Metrics::toJSON() const {
+    /// return all values as a JSON object
+    /*!
+      The result looks like:
+      {"phases":{"xml tokenize":{"wall":0.1,"cpu":0.1,"calls":1},...},
+       "counters":{"elements_created":12,...}}
+      Times are in seconds
+    */
+    MetricsSnapshot snap = snapshot();
+    ostringstream os;
+    os << "{\"phases\":{";
+    for ( unsigned int i=0; i < PHASE_COUNT; ++i ){
+      if ( i > 0 ){
+	os << ",";
+      }
+      os << "\"" << toString( static_cast<Phase>(i) ) << "\":{\"wall\":"
+	 << snap.wall[i] << ",\"cpu\":" << snap.cpu[i]
+	 << ",\"calls\":" << snap.calls[i] << "}";
+    }
+    os << "},\"counters\":{";
+    for ( unsigned int i=0; i < COUNTER_COUNT; ++i ){
+      if ( i > 0 ){
+	os << ",";
+      }
+      os << "\"" << toString( static_cast<Counter>(i) ) << "\":"
+	 << snap.counts[i];
+    }
+    os << "}}";
+    return os.str();
+  }
+
+  /// the innermost running timer on this thread
+  static thread_local PhaseTimer *current_timer = 0;
+
+  static uint64_t wall_now(){
+    return chrono::duration_cast<chrono::nanoseconds>(
+	     chrono::steady_clock::now().time_since_epoch() ).count();
+  }
+
+  static uint64_t cpu_now(){
+    /// the CPU time used by this thread
+    timespec ts;
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+  void PhaseTimer::charge( uint64_t wall, uint64_t cpu, bool done ){
+    /// charge the time since the last (re)start to our phase
+    _metrics->add( _phase, wall - _wall, cpu - _cpu, done ? 1 : 0 );
+    _wall = wall;
+    _cpu = cpu;
+  }
+
+  void PhaseTimer::start(){
+    /// start timing. A running outer timer is paused
+    if ( current_timer
+	 && current_timer->_phase == _phase ){
+      // already timing this phase
+      _metrics = 0;
+      return;
+    }
+    uint64_t wall = wall_now();
+    uint64_t cpu = cpu_now();
+    if ( current_timer ){
+      current_timer->charge( wall, cpu, false );
+    }
+    _wall = wall;
+    _cpu = cpu;
+    _outer = current_timer;
+    current_timer = this;
+  }
+
+  void PhaseTimer::stop(){
+    /// stop timing, and resume the outer timer
+    uint64_t wall = wall_now();
+    uint64_t cpu = cpu_now();
+    charge( wall, cpu, true );
+    current_timer = _outer;
+    if ( _outer ){
+      _outer->_wall = wall;
+      _outer->_cpu = cpu;
+    }
+  }
+
+} // namespace folia
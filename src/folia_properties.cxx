@@ -26,8 +26,14 @@
 
 #include <set>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
 #include <iostream>
+#include <array>
+#include <bitset>
 
+#include "libxml/parser.h"
 #include "libfolia/folia.h"
 #include "libfolia/folia_properties.h"
 
@@ -644,19 +650,12 @@ namespace folia {
   properties Word::PROPS = DEFAULT_PROPERTIES;
   properties WordReference::PROPS = DEFAULT_PROPERTIES;
 
-  set<ElementType>& operator+=( set<ElementType>& a ,
-				const set<ElementType>& b ){
-    a.insert(b.begin(), b.end());
-    return a;
-  }
-
-  map<ElementType,properties*> element_props;
-  map<ElementType,ElementType> abstract_parents;
+  ElementTable<properties*> element_props;
+  ElementTable<ElementType> abstract_parents; ///< BASE when there is none
 
   ElementType get_abstract_parent( const ElementType et ) {
-    const auto& it = abstract_parents.find( et );
-    if ( it != abstract_parents.end() ){
-      return it->second;
+    if ( static_cast<size_t>(et) < ElementTypeSet::SIZE ){
+      return abstract_parents[et];
     }
     return ElementType::BASE;
   }
@@ -665,6 +664,9 @@ namespace folia {
     return get_abstract_parent( el->element_id() );
   }
 
+  static void init_type_bits( const vector<const properties*>& );
+  static void init_tag_hash();
+
   void static_init(){
     /// initialize a lot of statics ('constants')
     /// This function should be called once.
@@ -1865,6 +1867,16 @@ namespace folia {
     for ( const auto& [ann,et] : annotationtype_elementtype_map ){
       element_annotation_map[et] = ann;
     }
+    vector<const properties*> all_props = { &XmlText::PROPS,
+					     &XmlComment::PROPS,
+					     &ProcessingInstruction::PROPS };
+    for ( const auto *props : element_props ){
+      if ( props ){
+	all_props.push_back( props );
+      }
+    }
+    init_type_bits( all_props );
+    init_tag_hash();
   }
 
 
@@ -2323,6 +2335,40 @@ namespace folia {
     return 0;
   }
 
+  const size_t ET_COUNT = static_cast<size_t>(ElementType::LastElement);
+  using type_bits = bitset<ET_COUNT>;
+  /// per ElementType: the types it is a (direct or indirect) subtype of,
+  /// including itself
+  static array<type_bits,ET_COUNT> subtype_bits;
+  /// per ElementType: the types it accepts as a child, including the
+  /// subtypes of the types in it's ACCEPTED_DATA
+  static array<type_bits,ET_COUNT> accept_bits;
+
+  static void init_type_bits( const vector<const properties*>& all_props ){
+    /// fill the subtype_bits and accept_bits tables
+    /*!
+      \param all_props the properties of all ElementTypes
+    */
+    for ( size_t i=0; i < ET_COUNT; ++i ){
+      subtype_bits[i].set( i );
+    }
+    for ( const auto& [et,supers] : typeHierarchy ){
+      for ( const auto& super : supers ){
+	subtype_bits[static_cast<size_t>(et)].set( static_cast<size_t>(super) );
+      }
+    }
+    for ( const auto *props : all_props ){
+      type_bits& row = accept_bits[static_cast<size_t>(props->ELEMENT_ID)];
+      for ( const auto& acc : props->ACCEPTED_DATA ){
+	for ( size_t i=0; i < ET_COUNT; ++i ){
+	  if ( subtype_bits[i][static_cast<size_t>(acc)] ){
+	    row.set( i );
+	  }
+	}
+      }
+    }
+  }
+
   bool is_subtype( const ElementType& e1, const ElementType& e2 ){
     /// check if an ElementType is a direct or indirect subclass of another one
     /*!
@@ -2333,11 +2379,187 @@ namespace folia {
     if ( e1 == e2 ){
       return true;
     }
-    const auto& it = typeHierarchy.find( e1 );
-    if ( it != typeHierarchy.end() ){
-      return it->second.find( e2 ) != it->second.end();
+    size_t i1 = static_cast<size_t>(e1);
+    size_t i2 = static_cast<size_t>(e2);
+    return i1 < ET_COUNT && i2 < ET_COUNT && subtype_bits[i1][i2];
+  }
+
+  bool is_acceptable( const ElementType& parent, const ElementType& child ){
+    /// check if an ElementType may be added to a parent of another type
+    /*!
+      \param parent the ElementType of the parent
+      \param child the ElementType of the new child
+      \return true if child, or one of it's supertypes, is in the
+      ACCEPTED_DATA of parent
+    */
+    size_t p = static_cast<size_t>(parent);
+    size_t c = static_cast<size_t>(child);
+    return p < ET_COUNT && c < ET_COUNT && accept_bits[p][c];
+  }
+
+  /// a perfect hash over all FoLiA tags, including the old ones.
+  /*!
+    A tag hashes to a bucket, which holds a displacement. Together with the
+    hash this gives the slot in tag_slots. The displacements are chosen in
+    init_tag_hash(), so that no two tags share a slot.
+  */
+  const size_t TAG_BUCKETS = 64;
+  const size_t TAG_SLOTS = 512;
+  struct tag_slot {
+    string_view tag;
+    ElementType et;
+  };
+  static array<uint16_t,TAG_BUCKETS> tag_disp;
+  static array<tag_slot,TAG_SLOTS> tag_slots;
+
+  static inline uint64_t tag_hash( string_view tag ){
+    /// FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for ( const unsigned char c : tag ){
+      h ^= c;
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  static inline size_t tag_slot_of( uint64_t h, uint16_t disp ){
+    uint32_t h1 = static_cast<uint32_t>( h );
+    uint32_t h2 = static_cast<uint32_t>( h >> 32 ) | 1;
+    return ( h1 + disp * h2 ) & ( TAG_SLOTS - 1 );
+  }
+
+  static void init_tag_hash(){
+    /// fill tag_disp and tag_slots from s_et_map and oldtags
+    vector<vector<tag_slot>> buckets( TAG_BUCKETS );
+    for ( const auto& [tag,et] : s_et_map ){
+      uint64_t h = tag_hash( tag );
+      buckets[(h>>32) & (TAG_BUCKETS-1)].push_back( { tag, et } );
+    }
+    for ( const auto& [old,tag] : oldtags ){
+      uint64_t h = tag_hash( old );
+      buckets[(h>>32) & (TAG_BUCKETS-1)].push_back( { old, s_et_map.at(tag) } );
+    }
+    vector<size_t> order( TAG_BUCKETS );
+    for ( size_t i=0; i < TAG_BUCKETS; ++i ){
+      order[i] = i;
+    }
+    // place the largest buckets first
+    stable_sort( order.begin(), order.end(),
+		 [&]( size_t a, size_t b ){
+		   return buckets[a].size() > buckets[b].size(); } );
+    vector<bool> used( TAG_SLOTS, false );
+    for ( const auto b : order ){
+      if ( buckets[b].empty() ){
+	break;
+      }
+      bool placed = false;
+      for ( uint32_t d=0; d < 65536 && !placed; ++d ){
+	vector<size_t> slots;
+	for ( const auto& ts : buckets[b] ){
+	  size_t s = tag_slot_of( tag_hash( ts.tag ), d );
+	  if ( used[s]
+	       || find( slots.begin(), slots.end(), s ) != slots.end() ){
+	    break;
+	  }
+	  slots.push_back( s );
+	}
+	if ( slots.size() == buckets[b].size() ){
+	  for ( size_t i=0; i < slots.size(); ++i ){
+	    used[slots[i]] = true;
+	    tag_slots[slots[i]] = buckets[b][i];
+	  }
+	  tag_disp[b] = static_cast<uint16_t>( d );
+	  placed = true;
+	}
+      }
+      if ( !placed ){
+	throw logic_error( "init_tag_hash(): unable to build the tag table" );
+      }
+    }
+  }
+
+  bool lookupElementType( string_view tag, ElementType& et ){
+    /// find the ElementType of a tag
+    /*!
+      \param tag the tag to look up. Old pre v1.5 tags are handled too
+      \param et the ElementType found
+      \return true when tag is known
+
+      This costs one hash over the tag and one string compare.
+    */
+    uint64_t h = tag_hash( tag );
+    uint16_t disp = tag_disp[(h>>32) & (TAG_BUCKETS-1)];
+    const tag_slot& ts = tag_slots[tag_slot_of( h, disp )];
+    if ( tag.empty() || ts.tag != tag ){
+      return false;
+    }
+    et = ts.et;
+    return true;
+  }
+
+  template <typename T>
+  static void mark_class( const FoliaElement *proto, type_bits& row ){
+    /// set the bit for class T in row, when proto is a T
+    if ( dynamic_cast<const T*>( proto ) ){
+      row.set( static_cast<size_t>( element_type_of<T>::value() ) );
+    }
+  }
+
+  static array<type_bits,ET_COUNT> init_class_bits(){
+    /// build the C++ class hierarchy table used by isSubClass<T>()
+    /*!
+      \return per ElementType the ElementTypes of all C++ classes an element
+      of that type derives from, including it's own.
+
+      This is NOT the same as the typeHierarchy: f.e. our C++ Morpheme
+      derives from AbstractStructureElement, the FoLiA morpheme doesn't.
+      We create one instance of every concrete class and check it against
+      the abstract classes. Concrete classes never derive from each other.
+    */
+    array<type_bits,ET_COUNT> result;
+    for ( size_t i=0; i < ET_COUNT; ++i ){
+      FoliaElement *proto = 0;
+      try {
+	proto = FoliaElement::private_createElement( ElementType(i) );
+      }
+      catch ( const ValueError& ){
+	// abstract
+	result[i].set( i );
+	continue;
+      }
+      type_bits& row = result[i];
+      row.set( i );
+      mark_class<AbstractFeature>( proto, row );
+      mark_class<AbstractWord>( proto, row );
+      mark_class<AbstractAnnotationLayer>( proto, row );
+      mark_class<AbstractContentAnnotation>( proto, row );
+      mark_class<AbstractCorrectionChild>( proto, row );
+      mark_class<AbstractHigherOrderAnnotation>( proto, row );
+      mark_class<AbstractInlineAnnotation>( proto, row );
+      mark_class<AbstractSpanAnnotation>( proto, row );
+      mark_class<AbstractSpanRole>( proto, row );
+      mark_class<AbstractStructureElement>( proto, row );
+      mark_class<AbstractSubtokenAnnotation>( proto, row );
+      mark_class<AbstractTextMarkup>( proto, row );
+      proto->destroy();
     }
-    return false;
+    return result;
+  }
+
+  bool is_subclass( const ElementType& et, const ElementType& cls ){
+    /// check if elements of type et are instances of the C++ class of cls
+    /*!
+      \param et the ElementType of a node
+      \param cls the ElementType of a C++ class
+      \return true when the class of et is cls, or derives from it
+
+      The table is built on first use, as it needs fully initialized
+      classes.
+    */
+    static const array<type_bits,ET_COUNT> class_bits = init_class_bits();
+    size_t i1 = static_cast<size_t>(et);
+    size_t i2 = static_cast<size_t>(cls);
+    return i1 < ET_COUNT && i2 < ET_COUNT && class_bits[i1][i2];
   }
 
   bool isAttributeFeature( const string& att ){
@@ -2373,7 +2595,7 @@ namespace folia {
     }
   }
 
-  string host_name;
+  string host_name; // deprecated. Filled by get_host_name() on first use
 
   namespace {
     //
@@ -2384,7 +2606,9 @@ namespace folia {
     struct initializer {
      initializer() {
        static_init();
-       host_name = get_fqdn();
+       // libxml2 sets up its global state lazily, which is not thread safe.
+       // Do it now, before any thread can start parsing.
+       xmlInitParser();
        //	print_type_hierarchy( cout );
      }
       ~initializer() {
@@ -93,9 +93,10 @@ namespace folia {
       will set the hostname, the username, the current time and the FoLiA
       version
 
-      The hostname is cached, to avoid excessive call to getaddrinfo()
+      The hostname is looked up on first use and then cached, see
+      get_host_name()
     */
-    _host = host_name;
+    _host = get_host_name();
     _begindatetime = get_ISO_date();
     _folia_version = folia::folia_version();
     _user = get_user();
@@ -0,0 +1,93 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of libfolia
+
+  libfolia is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  libfolia is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at) science.ru.nl
+*/
+
+#ifndef FOLIA_RAW_INPUT_H
+#define FOLIA_RAW_INPUT_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <iostream>
+
+namespace folia {
+
+  class raw_input {
+    /// a forward-only scanner over the bytes of an XML input
+    /*!
+      It doesn't check the XML, as the xmlTextReader on the same input does
+      that. It only finds the boundaries of the markup, and copies the bytes
+      it passes to an output stream, or drops them.
+      Elements (start tags) and PI's are counted, so the position can be
+      kept in step with the xmlTextReader.
+    */
+  public:
+    enum class token { NONE, START, EMPTY, END, PI, OTHER };
+    explicit raw_input( std::istream *is ):
+      _is(is), _out(0), _base(0), _pos(0), _mark(0), _count(0) {};
+    ~raw_input(){ delete _is; };
+    size_t count() const { return _count; };
+    /// the offset in the input of the current position
+    uint64_t position() const { return _base + _pos; };
+    /// the name of the last start or end tag
+    const std::string& name() const { return _name; };
+    /// the text of the last start or end tag
+    const std::string& tag() const { return _tag; };
+    void pass_root();
+    bool pass_to( size_t, std::ostream * );
+    void skip_node();
+    void pass_rest( std::ostream * );
+    void pass_text();
+    token pass_token();
+  private:
+    raw_input( const raw_input& ) = delete;
+    raw_input& operator=( const raw_input& ) = delete;
+    int peek( size_t off = 0 ){
+      /// the byte at offset off from the current position, or EOF
+      while ( _pos + off >= _buf.size() ){
+	if ( !fill() ){
+	  return EOF;
+	}
+      }
+      return static_cast<unsigned char>(_buf[_pos+off]);
+    }
+    bool fill();
+    void emit();
+    void select_output( std::ostream * );
+    void skip_past( const std::string& );
+    std::istream *_is;
+    std::ostream *_out;
+    std::string _buf;   // the bytes read, from the first byte not yet handled
+    uint64_t _base;     // the offset in the input of _buf[0]
+    size_t _pos;   // the current position in _buf
+    size_t _mark;  // the first byte in _buf not yet copied or dropped
+    size_t _count; // the number of elements and PI's passed
+    std::string _name;  // the name of the last start or end tag
+    std::string _tag;   // the text of the last start or end tag
+  };
+
+} // namespace folia
+
+#endif // FOLIA_RAW_INPUT_H
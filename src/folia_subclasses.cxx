@@ -2686,15 +2686,6 @@ namespace folia {
     return this;
   }
 
-  static void error_sink(void *mydata, const xmlError *error ) {
-    /// helper function for Xml parsing
-    int *cnt = static_cast<int*>(mydata);
-    if ( *cnt == 0 ) {
-      cerr << "\nXML-error: " << error->message << endl;
-    }
-    (*cnt)++;
-  }
-
   void External::resolve_external( ) {
     /// resolve external references
     /*!
@@ -2707,9 +2698,8 @@ namespace folia {
     try {
       src = AbstractElement::src();
       DBG << "try to resolve: " << src << endl;
-      int cnt = 0;
-      xmlSetStructuredErrorFunc( &cnt, (xmlStructuredErrorFunc)error_sink );
-      xmlDoc *extdoc = xmlReadFile( src.c_str(), 0, XML_PARSER_OPTIONS );
+      XmlParseContext parser;
+      xmlDoc *extdoc = parser.read_file( src, XML_PARSER_OPTIONS );
       if ( extdoc ) {
 	const xmlNode *root = xmlDocGetRootElement( extdoc );
 	xmlNode *p = root->children;
@@ -2734,6 +2724,9 @@ namespace folia {
 	}
 	xmlFreeDoc( extdoc );
       }
+      else if ( parser.count() > 0 ) {
+	throw XmlParseError( src, parser.diagnostics(), parser.count() );
+      }
       else {
 	throw XmlError( this, "resolving external " + src + " failed" );
       }
@@ -127,24 +127,19 @@ namespace folia {
     return result->second;
   }
 
-  ElementType stringToElementType( const string& intag ){
+  ElementType stringToElementType( string_view tag ){
     // convert a string into an ElementType
     /*!
-     * \param intag a string representing an ElementType
+     * \param tag a string representing an ElementType
      * \return an ElementType. Throws when not found.
      *
      * Also handles 'old' pre v1.5 names.
      */
-    string tag = intag;
-    auto const tr = oldtags.find(intag);
-    if ( tr != oldtags.end() ){
-      tag = tr->second;
-    }
-    auto result = s_et_map.find(tag);
-    if ( result == s_et_map.end() ){
-      throw ValueError( "unknown tag <" + tag + ">" );
+    ElementType result;
+    if ( !lookupElementType( tag, result ) ){
+      throw ValueError( "unknown tag <" + string(tag) + ">" );
     }
-    return result->second;
+    return result;
   }
 
   string toString( const Attrib at ){
@@ -28,6 +28,7 @@
 #include <cassert>
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <string>
 #include <vector>
 #include <map>
@@ -39,12 +40,18 @@
 #include <netdb.h>
 #include <stdexcept>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
 #include "ticcutils/StringOps.h"
 #include "ticcutils/XMLtools.h"
 #include "ticcutils/PrettyPrint.h"
 #include "ticcutils/Unicode.h"
+#include "ticcutils/FileUtils.h"
 #include "libfolia/folia.h"
 #include "libfolia/folia_properties.h"
+#include "folia_counters.h"
 
 using namespace std;
 using namespace icu;
@@ -111,14 +118,16 @@ namespace folia {
   NoSuchText::NoSuchText( const FoliaElement *elt,
 			  const std::string& mess ):
     std::runtime_error(	output_elem( elt)
-			+ ": NO text content: " + mess ){};
+			+ ": NO text content: " + mess ){
+    FOLIA_COUNT( elt->doc(), Counter::NO_SUCH_TEXT, 1 );
+  };
 
   NoSuchPhon::NoSuchPhon( const FoliaElement *elt,
 			  const std::string& mess ):
     std::runtime_error( output_elem( elt)
 			+ ": NO phon content: " + mess ){};
 
-  FoliaElement *FoliaElement::createElement( const string& tag,
+  FoliaElement *FoliaElement::createElement( string_view tag,
 					     Document *doc ){
     /// create a new FoliaElement
     /*!
@@ -304,7 +313,7 @@ namespace folia {
     }
   }
 
-  bool KWargs::is_present( const string& att ) const {
+  bool KWargs::is_present( string_view att ) const {
     /// check if an attribute is present in the KWargs
     /*!
       \param att The attribute to check
@@ -313,7 +322,7 @@ namespace folia {
     return find(att) != end();
   }
 
-  string KWargs::lookup( const string& att ) const {
+  string KWargs::lookup( string_view att ) const {
     /// lookup an attribute
     /*!
       \param att The attribute to check
@@ -327,7 +336,7 @@ namespace folia {
     return result;
   }
 
-  string KWargs::extract( const string& att ){
+  string KWargs::extract( string_view att ){
     /// lookup and remove an attribute
     /*!
       \param att The attribute to check
@@ -706,7 +715,6 @@ namespace folia {
     if ((gai_result = getaddrinfo(hostname, "http", &hints, &info)) != 0) {
       //      cerr << "getaddrinfo failed: " << gai_strerror(gai_result)
       //	   << ", using 'unknown' as hostname" << endl;
-      freeaddrinfo(info);
       result = hostname;
       return result;
     }
@@ -719,6 +727,174 @@ namespace folia {
     return result;
   }
 
+  static mutex host_mutex;
+  static string cached_host; ///< the cached host name, empty when unknown
+
+  string get_host_name(){
+    /// return the name of the host we are running on, as used in processors
+    /*!
+      \return the value set by set_host_name(), or else the value of the
+      FOLIA_HOSTNAME environment variable, or else the result of get_fqdn()
+
+      The (possibly slow) DNS lookup in get_fqdn() is done on the first call
+      only, the result is cached. The deprecated global host_name is only
+      filled from then on.
+    */
+    lock_guard<mutex> lock( host_mutex );
+    if ( cached_host.empty() ){
+      const char *env = getenv( "FOLIA_HOSTNAME" );
+      if ( env && *env ){
+	cached_host = env;
+      }
+      else {
+	cached_host = get_fqdn();
+      }
+      // keep the deprecated global in sync
+      host_name = cached_host;
+    }
+    return cached_host;
+  }
+
+  void set_host_name( const string& name ){
+    /// override the host name used in processors
+    /*!
+      \param name the name to use. An empty name clears the cached value,
+      so the next get_host_name() will look it up again
+    */
+    lock_guard<mutex> lock( host_mutex );
+    cached_host = name;
+    host_name = name;
+  }
+
+  string XmlDiagnostic::toString() const {
+    /// format a diagnostic like: file:line: XML-error: message
+    /*!
+      When present, the context is added on the next line(s)
+    */
+    string result;
+    if ( !file.empty() ){
+      result += file + ":";
+      if ( line > 0 ){
+	result += TiCC::toString(line) + ":";
+      }
+    }
+    result += " XML-error: " + message;
+    if ( !context.empty() ){
+      result += "\n" + context;
+    }
+    return result;
+  }
+
+  static string diagnostics_message( const vector<XmlDiagnostic>& diags,
+				     size_t count ){
+    /// the what() message of an XmlParseError
+    string result = "document is invalid";
+    if ( !diags.empty() ){
+      result += "\n" + diags.front().toString();
+    }
+    if ( count > 1 ){
+      result += "\n(" + TiCC::toString(count-1) + " more XML problems)";
+    }
+    return result;
+  }
+
+  XmlParseError::XmlParseError( const string& document,
+				const vector<XmlDiagnostic>& diags,
+				size_t count ):
+    DocumentError( document, diagnostics_message( diags, count ) ),
+    _diagnostics( diags ),
+    _count( count )
+  {}
+
+  XmlParseContext::XmlParseContext( size_t max_kept ):
+    _max_kept( max_kept ),
+    _count( 0 )
+  {
+    /// create a parser context, with our sink as its error handler
+    _ctxt = xmlNewParserCtxt();
+    if ( !_ctxt ){
+      throw runtime_error( "unable to create a libxml2 parser context" );
+    }
+    // libxml2 calls serror with ctxt->userData, which the SAX2 handlers
+    // need to be the context itself. So find our way back via _private
+    _ctxt->_private = this;
+    _ctxt->sax->serror = (xmlStructuredErrorFunc)sink;
+  }
+
+  XmlParseContext::~XmlParseContext(){
+    xmlFreeParserCtxt( _ctxt );
+  }
+
+  xmlDoc *XmlParseContext::read_file( const string& file_name,
+				      int options ){
+    /// parse a file
+    /*!
+      \param file_name the file to parse
+      \param options the xmlParserOption flags
+      \return the parsed document, or 0 on failure. Any problems are
+      available in diagnostics()
+    */
+    return xmlCtxtReadFile( _ctxt, file_name.c_str(), 0, options );
+  }
+
+  xmlDoc *XmlParseContext::read_memory( const string& buffer,
+					const string& url,
+					int options ){
+    /// parse a buffer
+    /*!
+      \param buffer the XML
+      \param url the name used in the diagnostics. May be empty
+      \param options the xmlParserOption flags
+      \return the parsed document, or 0 on failure. Any problems are
+      available in diagnostics()
+    */
+    return xmlCtxtReadMemory( _ctxt, buffer.c_str(), buffer.length(),
+			      url.empty() ? 0 : url.c_str(), 0, options );
+  }
+
+  void XmlParseContext::sink( void *mydata, const xmlError *error ){
+    /// the structured error handler of an XmlParseContext
+    /*!
+      \param mydata the xmlParserCtxt that raised the error
+      \param error an xmlError structure created by a libxml2 function
+
+      Stores the details of the error. For the first error, the offending
+      node and a marker at the error position are added too.
+     */
+    const xmlParserCtxt *ctx = static_cast<const xmlParserCtxt*>(mydata);
+    XmlParseContext *pc = static_cast<XmlParseContext*>(ctx->_private);
+    if ( pc->_diagnostics.size() < pc->_max_kept ){
+      XmlDiagnostic diag;
+      diag.level = error->level;
+      diag.domain = error->domain;
+      diag.code = error->code;
+      if ( error->file ){
+	diag.file = error->file;
+      }
+      diag.line = error->line;
+      diag.column = error->int2;
+      if ( error->message ){
+	diag.message = TiCC::trim( string(error->message), "\n" );
+      }
+      if ( pc->_count == 0
+	   && ctx->myDoc
+	   && ctx->node ){
+	xmlBuffer *buffer = xmlBufferCreate();
+	int size = xmlNodeDump(buffer, ctx->myDoc, ctx->node, 0, 1 );
+	diag.context = string( ctx->nodeNr*2, ' ')
+	  + TiCC::to_string( buffer->content );
+	xmlBufferFree( buffer );
+	if ( size >=0
+	     && error->int2 != 0 ){
+	  diag.context += "\n" + string( std::min(error->int2,size), ' ')
+	    + "^";
+	}
+      }
+      pc->_diagnostics.push_back( diag );
+    }
+    ++pc->_count;
+  }
+
   string get_user(){
     /// function to get the username of the program
     /*!
@@ -838,11 +1014,36 @@ namespace folia {
 	      cerr << "the xmltag " << tmp2->xmltag() << " != " << s << endl;
 	      sane = false;
 	    }
+	    const auto& accepted = dynamic_cast<AbstractElement*>(tmp2)->accepted_data();
+	    for ( auto const& [child,dummy] : et_s_map ){
+	      bool expected = any_of( accepted.begin(), accepted.end(),
+				      [child]( const ElementType& acc ){
+					return is_subtype( child, acc ); } );
+	      if ( tmp2->acceptable( child ) != expected ){
+		cerr << "acceptable(" << toString(child) << ") for "
+		     << s << " is " << !expected << endl;
+		sane = false;
+	      }
+	    }
 	    destroy(tmp2);
 	  }
 	}
       }
     }
+    for ( auto const& [old,tag] : oldtags ){
+      if ( stringToElementType( old ) != stringToElementType( tag ) ){
+	cerr << "old tag <" << old << "> doesn't map to <" << tag << ">" << endl;
+	sane = false;
+      }
+    }
+    for ( const char *bad : { "", "W", "wo", "word", "_XmlCommentx" } ){
+      ElementType et;
+      if ( lookupElementType( bad, et ) ){
+	cerr << "unknown tag <" << bad << "> was found as " << toString(et)
+	     << endl;
+	sane = false;
+      }
+    }
     return sane;
   }
 
@@ -884,6 +1085,77 @@ namespace folia {
       return EXIT_FAILURE;
     }
     cerr << s->text() << endl;
+    FoliaElement *w1 = s->index(0);
+    FoliaElement *dup = new TextContent( getArgs( "value='De'" ) );
+    try {
+      w1->append( dup );
+      cerr << " A second <t> with the same class was accepted" << endl;
+      return false;
+    }
+    catch ( const DuplicateAnnotationError& ){
+      dup->destroy();
+    }
+    FoliaElement *last = s->index(4);
+    s->remove( last );
+    last->destroy();
+    if ( s->count_children( ElementType::Word_t ) != 4
+	 || s->count_children( ElementType::Word_t )
+	 != s->select( ElementType::Word_t, SELECT_FLAGS::LOCAL ).size() ){
+      cerr << " Child count does not match after removal: "
+	   << s->count_children( ElementType::Word_t ) << endl;
+      return false;
+    }
+    FoliaElement *t1 = new TextContent( getArgs( "value='De site staat online'" ) );
+    s->append( t1 );
+    t1->set_cls( "other" );
+    FoliaElement *t2 = new TextContent( getArgs( "value='De site staat online'" ) );
+    try {
+      s->append( t2 );
+    }
+    catch ( const DuplicateAnnotationError& ){
+      cerr << " Child count not updated after set_cls()" << endl;
+      t2->destroy();
+      return false;
+    }
+    if ( !s->has_text_class( "", "other" ) ){
+      cerr << " has_text_class() missed a changed class" << endl;
+      return false;
+    }
+    set_host_name( "sanity.host" );
+    if ( get_host_name() != "sanity.host" || host_name != "sanity.host" ){
+      cerr << " set_host_name() was ignored: " << get_host_name() << endl;
+      return false;
+    }
+    set_host_name( "" );
+    if ( d.metrics() ){
+      cerr << " metrics are collected without asking" << endl;
+      return false;
+    }
+    Document timed( "metrics='yes'" );
+    timed.read_from_string( d.xmlstring() );
+    timed.xmlstring();
+    const Metrics *m = timed.metrics();
+    if ( !m
+	 || m->calls( Phase::TOKENIZE ) != 1
+	 || m->calls( Phase::BUILD ) != 1
+	 || m->calls( Phase::SERIALIZE ) != 1
+	 || m->calls( Phase::DECLARATIONS ) == 0
+	 || m->wall( Phase::BUILD ) <= 0 ){
+      cerr << " the phases of a parse are not timed correctly" << endl;
+      return false;
+    }
+    MetricsSnapshot snap = m->snapshot();
+    size_t serialized = timed.xmlstring().size();
+    if ( snap.counts[static_cast<unsigned int>(Counter::ELEMENTS_CREATED)] == 0
+	 || m->counter( Counter::INDEX_LOOKUPS ) == 0
+	 || m->counter( Counter::BYTES_SERIALIZED )
+	 != snap.counts[static_cast<unsigned int>(Counter::BYTES_SERIALIZED)]
+	 + serialized
+	 || m->toJSON().find( "\"elements_created\":" ) == string::npos ){
+      cerr << " the events of a parse are not counted correctly: "
+	   << m->toJSON() << endl;
+      return false;
+    }
     d.setdebug( "ANNOTATIONS|SERIALIZE" );
     assert( toString(d.debug) == "ANNOTATIONS|SERIALIZE" );
     return true;
@@ -963,6 +1235,16 @@ namespace folia {
     return true;
   }
 
+  template <typename T>
+  static bool check_subclass( const FoliaElement *el, const string& name ){
+    bool expected = ( dynamic_cast<const T*>( el ) != nullptr );
+    if ( el->isSubClass<T>() != expected ){
+      cerr << el->xmltag() << "::isSubClass<" << name << ">() failed" << endl;
+      return false;
+    }
+    return true;
+  }
+
   bool subclass_sanity_check(){
     if ( isSubClass<AbstractWord,Word>() ){
       cerr << "isSubClass<AbstractWord,Word>() failed" << endl;
@@ -1035,6 +1317,37 @@ namespace folia {
 	return false;
       }
     }
+    for ( size_t i=0; i < size_t(ElementType::LastElement); ++i ){
+      // the precomputed table must agree with dynamic_cast
+      FoliaElement *el = 0;
+      try {
+	el = FoliaElement::private_createElement( ElementType(i) );
+      }
+      catch ( const ValueError& ){
+	continue;
+      }
+      bool ok = check_subclass<AbstractFeature>( el, "AbstractFeature" )
+	&& check_subclass<AbstractWord>( el, "AbstractWord" )
+	&& check_subclass<AbstractAnnotationLayer>( el, "AbstractAnnotationLayer" )
+	&& check_subclass<AbstractContentAnnotation>( el, "AbstractContentAnnotation" )
+	&& check_subclass<AbstractCorrectionChild>( el, "AbstractCorrectionChild" )
+	&& check_subclass<AbstractHigherOrderAnnotation>( el, "AbstractHigherOrderAnnotation" )
+	&& check_subclass<AbstractInlineAnnotation>( el, "AbstractInlineAnnotation" )
+	&& check_subclass<AbstractSpanAnnotation>( el, "AbstractSpanAnnotation" )
+	&& check_subclass<AbstractSpanRole>( el, "AbstractSpanRole" )
+	&& check_subclass<AbstractStructureElement>( el, "AbstractStructureElement" )
+	&& check_subclass<AbstractSubtokenAnnotation>( el, "AbstractSubtokenAnnotation" )
+	&& check_subclass<AbstractTextMarkup>( el, "AbstractTextMarkup" )
+	&& check_subclass<TextContent>( el, "TextContent" )
+	&& check_subclass<String>( el, "String" )
+	&& check_subclass<Word>( el, "Word" )
+	&& check_subclass<Morpheme>( el, "Morpheme" )
+	&& check_subclass<Phoneme>( el, "Phoneme" );
+      el->destroy();
+      if ( !ok ){
+	return false;
+      }
+    }
     try {
       vector<FoliaElement*> ve;
       vector<Paragraph*> vp;
@@ -1047,4 +1360,795 @@ namespace folia {
     return true;
   }
 
+  bool binary_sanity_check(){
+    Document d( "xml:id='bin'" );
+    FoliaElement *txt = d.addText( getArgs( "xml:id='bin.text'" ) );
+    FoliaElement *s = new Sentence( getArgs( "xml:id='bin.s.1'" ), &d );
+    txt->append( s );
+    KWargs kw;
+    kw.add("text","Snel");
+    s->addWord( kw );
+    kw.replace("text","weer");
+    s->addWord( kw );
+    kw.replace("text","terug");
+    s->addWord( kw );
+    s->settext( "Snel weer terug" );
+    stringstream ss;
+    if ( !d.save_binary( ss ) ){
+      cerr << "save_binary() failed" << endl;
+      return false;
+    }
+    Document d2;
+    try {
+      d2.load_binary( ss );
+    }
+    catch ( const exception& e ){
+      cerr << "load_binary() failed: " << e.what() << endl;
+      return false;
+    }
+    if ( d2.xmlstring() != d.xmlstring() ){
+      cerr << "binary round trip differs:\n" << d2.xmlstring()
+	   << "\nexpected:\n" << d.xmlstring() << endl;
+      return false;
+    }
+    if ( !d2["bin.s.1"] || d2["bin.s.1"]->size() != 4 ){
+      cerr << "binary round trip lost the index" << endl;
+      return false;
+    }
+    TiCC::tmp_stream ts( "foliabin" );
+    d.save_binary( ts.os() );
+    ts.close();
+    Document d4;
+    d4.set_lazy_types( { ElementType::Sentence_t } );
+    d4.map_binary( ts.tmp_name() );
+    AbstractElement *ms = dynamic_cast<AbstractElement*>(d4.index( "bin.s.1" ));
+    if ( !ms || !ms->is_deferred() ){
+      cerr << "map_binary() didn't defer the sentence" << endl;
+      return false;
+    }
+    FoliaElement *mw = d4["bin.s.1.w.3"];
+    if ( !mw || mw->str() != "terug" || ms->is_deferred() ){
+      cerr << "map_binary() failed to expand on index()" << endl;
+      return false;
+    }
+    if ( d4.xmlstring() != d.xmlstring() ){
+      cerr << "mapped snapshot differs:\n" << d4.xmlstring() << endl;
+      return false;
+    }
+    // the snapshot is trusted, but later modifications are checked
+    try {
+      mw->addPosAnnotation( getArgs( "set='undeclared-set', class='x'" ) );
+      cerr << "map_binary() left the declaration checks off" << endl;
+      return false;
+    }
+    catch ( const DeclarationError& ){
+    }
+    stringstream bad( "FoLiAbin garbage" );
+    Document d3;
+    try {
+      d3.load_binary( bad );
+      cerr << "load_binary() accepted garbage" << endl;
+      return false;
+    }
+    catch ( const exception& ){
+    }
+    return true;
+  }
+
+  bool lazy_sanity_check(){
+    Document d( "xml:id='lazy'" );
+    FoliaElement *txt = d.addText( getArgs( "xml:id='lazy.text'" ) );
+    for ( int i=1; i <= 2; ++i ){
+      string pid = "lazy.p." + TiCC::toString(i);
+      FoliaElement *p = new Paragraph( getArgs( "xml:id='" + pid + "'" ), &d );
+      txt->append( p );
+      FoliaElement *s = new Sentence( getArgs( "xml:id='" + pid + ".s.1'" ), &d );
+      p->append( s );
+      KWargs kw;
+      kw.add("text","Lui");
+      s->addWord( kw );
+      kw.replace("text","lekker");
+      s->addWord( kw );
+    }
+    string buffer = d.xmlstring();
+    Document l( "mode='lazy'" );
+    l.read_from_string( buffer );
+    AbstractElement *p2 = dynamic_cast<AbstractElement*>(l["lazy.p.2"]);
+    if ( !p2 || !p2->is_deferred() ){
+      cerr << "lazy mode didn't defer the paragraph" << endl;
+      return false;
+    }
+    FoliaElement *w = l["lazy.p.2.s.1.w.2"];
+    if ( !w || w->str() != "lekker" || p2->is_deferred() ){
+      cerr << "lazy mode failed to expand on index()" << endl;
+      return false;
+    }
+    if ( l.xmlstring() != buffer ){
+      cerr << "lazy mode output differs:\n" << l.xmlstring() << endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool parallel_sanity_check(){
+    Document d( "xml:id='par'" );
+    d.declare( AnnotationType::ENTITY, "ents" );
+    FoliaElement *txt = d.addText( getArgs( "xml:id='par.text'" ) );
+    FoliaElement *first = 0;
+    for ( int i=1; i <= 4; ++i ){
+      string pid = "par.p." + TiCC::toString(i);
+      FoliaElement *p = new Paragraph( getArgs( "xml:id='" + pid + "'" ), &d );
+      txt->append( p );
+      Sentence *s = new Sentence( getArgs( "xml:id='" + pid + ".s.1'" ), &d );
+      p->append( s );
+      KWargs kw;
+      kw.add("text","Lui");
+      Word *w = s->addWord( kw );
+      kw.replace("text","lekker");
+      s->addWord( kw );
+      if ( i == 1 ){
+	first = w;
+      }
+      else if ( i == 3 ){
+	// a reference into another subtree
+	FoliaElement *layer = new EntitiesLayer( getArgs( "set='ents'" ), &d );
+	s->append( layer );
+	FoliaElement *ent = new Entity( getArgs( "class='loc'" ), &d );
+	layer->append( ent );
+	ent->append( first );
+      }
+    }
+    string buffer = d.xmlstring();
+    Document par( "threads='4'" );
+    par.read_from_string( buffer );
+    if ( par.parse_threads() != 4 ){
+      cerr << "parse_threads() not set" << endl;
+      return false;
+    }
+    if ( par.xmlstring() != buffer ){
+      cerr << "parallel parse output differs:\n" << par.xmlstring() << endl;
+      return false;
+    }
+    if ( par.words().size() != 8
+	 || par["par.p.4.s.1.w.2"]->str() != "lekker" ){
+      cerr << "parallel parse lost nodes" << endl;
+      return false;
+    }
+    Document seq;
+    seq.read_from_string( buffer );
+    if ( par.unused_declarations() != seq.unused_declarations() ){
+      cerr << "parallel parse lost annotation references" << endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool concurrency_sanity_check(){
+    Document d( "xml:id='conc'" );
+    FoliaElement *txt = d.addText( getArgs( "xml:id='conc.text'" ) );
+    for ( int i=1; i <= 3; ++i ){
+      string pid = "conc.p." + TiCC::toString(i);
+      FoliaElement *p = new Paragraph( getArgs( "xml:id='" + pid + "'" ), &d );
+      txt->append( p );
+      Sentence *s = new Sentence( getArgs( "xml:id='" + pid + ".s.1'" ), &d );
+      p->append( s );
+      s->addWord( "text='Lui'" );
+      s->addWord( "text='lekker', space='no'" );
+      s->addWord( "text='.'" );
+    }
+    Document shared( "mode='lazy'" );
+    shared.read_from_string( d.xmlstring() );
+    shared.expand_all();
+    const string plain = shared.xmlstring();
+    const string kanon = shared.xmlstring( true );
+    stringstream ss;
+    shared.save( ss );
+    const string saved = ss.str();
+    const UnicodeString text = shared.text();
+    std::atomic<int> failures( 0 );
+    auto reader = [&]( int n ){
+      for ( int i=0; i < 25; ++i ){
+	if ( shared.xmlstring( (n+i) % 2 == 0 ) != ( (n+i) % 2 == 0 ? kanon : plain ) ){
+	  ++failures;
+	}
+	stringstream os;
+	shared.save( os );
+	if ( os.str() != saved
+	     || shared.text() != text
+	     || shared.words().size() != 9
+	     || shared["conc.p.2.s.1.w.2"]->str() != "lekker" ){
+	  ++failures;
+	}
+      }
+    };
+    vector<std::thread> threads;
+    for ( int n=0; n < 8; ++n ){
+      threads.emplace_back( reader, n );
+    }
+    for ( auto& t : threads ){
+      t.join();
+    }
+    if ( failures > 0 ){
+      cerr << "concurrent reads gave " << failures << " wrong results" << endl;
+      return false;
+    }
+    // parse valid and invalid documents at the same time. Every parse must
+    // see its own errors only, and the global libxml2 handler is not used
+    const string valid = d.xmlstring();
+    string invalid = valid;
+    invalid.replace( invalid.find( "conc.p.2.s.1.w.2" ), 16,
+		     "conc.p.2.s.1.w.1" );
+    xmlStructuredErrorFunc before = xmlStructuredError;
+    auto parser = [&]( int n ){
+      for ( int i=0; i < 10; ++i ){
+	Document doc;
+	try {
+	  doc.read_from_string( (n+i) % 2 == 0 ? valid : invalid );
+	  if ( (n+i) % 2 != 0 ){
+	    ++failures;
+	  }
+	}
+	catch ( const XmlParseError& e ){
+	  if ( (n+i) % 2 == 0
+	       || e.count() != 1
+	       || e.diagnostics().size() != 1
+	       || e.diagnostics()[0].message
+	       != "ID conc.p.2.s.1.w.1 already defined"
+	       || e.diagnostics()[0].line <= 0
+	       || e.diagnostics()[0].context.empty() ){
+	    ++failures;
+	  }
+	}
+      }
+    };
+    threads.clear();
+    for ( int n=0; n < 4; ++n ){
+      threads.emplace_back( parser, n );
+    }
+    for ( auto& t : threads ){
+      t.join();
+    }
+    if ( failures > 0 ){
+      cerr << "concurrent parses gave " << failures << " wrong results" << endl;
+      return false;
+    }
+    if ( xmlStructuredError != before ){
+      cerr << "the libxml2 error handler was changed" << endl;
+      return false;
+    }
+    try {
+      Document broken;
+      broken.read_from_string( "<?xml version=\"1.0\"?>\n<FoLiA><text>" );
+      cerr << "a truncated document was accepted" << endl;
+      return false;
+    }
+    catch ( const XmlParseError& e ){
+      if ( e.diagnostics().empty()
+	   || e.diagnostics()[0].level != XML_ERR_FATAL ){
+	cerr << "wrong diagnostics for a truncated document: " << e.what()
+	     << endl;
+	return false;
+      }
+    }
+    return true;
+  }
+
+  static void tag_words( FoliaElement *s ){
+    /// add a pos tag to every word of s
+    for ( const auto& w : s->select<Word>() ){
+      w->addPosAnnotation( getArgs( "class='" + w->str() + "'" ) );
+    }
+  }
+
+  static void add_late_lemma( FoliaElement *s ){
+    /// declare a new lemma set, and use it on the first word of s
+    s->doc()->declare( AnnotationType::LEMMA, "late-set" );
+    s->words(0)->addLemmaAnnotation( getArgs( "set='late-set', class='x'" ) );
+  }
+
+  static string file_contents( const string& name ){
+    /// return the contents of a file
+    ifstream is( name );
+    stringstream ss;
+    ss << is.rdbuf();
+    return ss.str();
+  }
+
+  static void engine_document( Document& d ){
+    /// fill d with 4 paragraphs of 3 sentences of 2 words
+    FoliaElement *txt = d.addText( getArgs( "xml:id='eng.text'" ) );
+    for ( int i=1; i <= 4; ++i ){
+      string pid = "eng.p." + TiCC::toString(i);
+      FoliaElement *p = new Paragraph( getArgs( "xml:id='" + pid + "'" ), &d );
+      txt->append( p );
+      for ( int j=1; j <= 3; ++j ){
+	string sid = pid + ".s." + TiCC::toString(j);
+	Sentence *s = new Sentence( getArgs( "xml:id='" + sid + "'" ), &d );
+	p->append( s );
+	s->addWord( "text='word" + TiCC::toString(j) + "'" );
+	s->addWord( "text='.'" );
+      }
+    }
+  }
+
+  static string engine_input(){
+    /// the input for the Engine checks, see engine_document()
+    Document d( "xml:id='eng'" );
+    engine_document( d );
+    stringstream ss;
+    d.save( ss );
+    return ss.str();
+  }
+
+  static string engine_output( const string& input,
+			       const string& out_name,
+			       unsigned int workers,
+			       Engine::FlushPolicy policy = Engine::FlushPolicy::NONE,
+			       size_t limit = 0,
+			       size_t *max_held = 0 ){
+    /// run an Engine that adds a pos tag to every word of every sentence,
+    /// with get_node() when workers == 0, otherwise with process().
+    /// max_held returns the maximum number of words kept in memory
+    Engine eng( input, out_name );
+    eng.declare( AnnotationType::POS, "engine-set" );
+    eng.set_auto_flush( policy, limit );
+    if ( workers == 0 ){
+      while ( FoliaElement *s = eng.get_node( "s" ) ){
+	tag_words( s );
+	if ( max_held ){
+	  size_t held = eng.doc()->doc()->select<Word>().size();
+	  *max_held = std::max( *max_held, held );
+	}
+      }
+    }
+    else {
+      eng.process( "s", tag_words, workers, 2 );
+    }
+    eng.finish();
+    return file_contents( out_name );
+  }
+
+  bool engine_sanity_check(){
+    const string input = engine_input();
+    TiCC::tmp_stream seq_file( "folia-seq", false );
+    seq_file.close();
+    TiCC::tmp_stream par_file( "folia-par", false );
+    par_file.close();
+    const string sequential = engine_output( input, seq_file.tmp_name(), 0 );
+    if ( sequential.find( "class=\"word3\"" ) == string::npos ){
+      cerr << " the engine didn't tag: " << sequential << endl;
+      return false;
+    }
+    for ( unsigned int workers : { 1, 3 } ){
+      const string parallel = engine_output( input, par_file.tmp_name(),
+					     workers );
+      if ( parallel != sequential ){
+	cerr << " Engine::process() with " << workers
+	     << " workers differs from get_node():" << endl
+	     << parallel << endl;
+	return false;
+      }
+    }
+    // a declaration by the handler of the first node must reach the header
+    auto declaring = []( FoliaElement *s ){
+      tag_words( s );
+      if ( s->id() == "eng.p.1.s.1" ){
+	add_late_lemma( s );
+      }
+    };
+    {
+      Engine eng( input, seq_file.tmp_name() );
+      eng.declare( AnnotationType::POS, "engine-set" );
+      while ( FoliaElement *s = eng.get_node( "s" ) ){
+	declaring( s );
+      }
+      eng.finish();
+    }
+    const string declared = file_contents( seq_file.tmp_name() );
+    if ( declared.find( "<lemma-annotation set=\"late-set\"" ) == string::npos ){
+      cerr << " the handler didn't declare: " << declared << endl;
+      return false;
+    }
+    for ( unsigned int workers : { 1, 3 } ){
+      Engine eng( input, par_file.tmp_name() );
+      eng.declare( AnnotationType::POS, "engine-set" );
+      eng.process( "s", declaring, workers, 2 );
+      eng.finish();
+      if ( file_contents( par_file.tmp_name() ) != declared ){
+	cerr << " Engine::process() with " << workers
+	     << " workers lost the declaration of a handler:" << endl
+	     << file_contents( par_file.tmp_name() ) << endl;
+	return false;
+      }
+    }
+    Engine failing( input, par_file.tmp_name() );
+    try {
+      failing.process( "s",
+		       []( FoliaElement *s ){
+			 if ( s->id() == "eng.p.3.s.2" ){
+			   throw ValueError( "bail out" );
+			 }
+		       },
+		       3 );
+      cerr << " Engine::process() swallowed the error of a handler" << endl;
+      return false;
+    }
+    catch ( const ValueError& ){
+    }
+    return true;
+  }
+
+  bool engine_flush_sanity_check(){
+    const string input = engine_input();
+    TiCC::tmp_stream seq_file( "folia-seq", false );
+    seq_file.close();
+    TiCC::tmp_stream out_file( "folia-flush", false );
+    out_file.close();
+    engine_output( input, seq_file.tmp_name(), 0 );
+    Document expected( seq_file.tmp_name() );
+    for ( const auto& [policy,limit] :
+	    { make_pair( Engine::FlushPolicy::TOP_NODES, 0 ),
+	      make_pair( Engine::FlushPolicy::ELEMENT_COUNT, 4 ),
+	      make_pair( Engine::FlushPolicy::BYTE_BUDGET, 100 ) } ){
+      size_t held = 0;
+      engine_output( input, out_file.tmp_name(), 0, policy, limit, &held );
+      Document flushed( out_file.tmp_name() );
+      if ( flushed.xmlstring() != expected.xmlstring() ){
+	cerr << " auto-flush changes the output: " << flushed << endl;
+	return false;
+      }
+      if ( policy == Engine::FlushPolicy::ELEMENT_COUNT && held > 4 ){
+	cerr << " auto-flush keeps " << held << " words in memory" << endl;
+	return false;
+      }
+    }
+    // a declaration while handling the first node is still output
+    auto lemmatize = []( const string& id ){
+      return [id]( FoliaElement *s ){
+	if ( s->id() == id ){
+	  add_late_lemma( s );
+	}
+      };
+    };
+    {
+      Engine eng( input, out_file.tmp_name() );
+      eng.set_auto_flush( Engine::FlushPolicy::TOP_NODES );
+      auto first = lemmatize( "eng.p.1.s.1" );
+      while ( FoliaElement *s = eng.get_node( "s" ) ){
+	first( s );
+      }
+      eng.finish();
+      Document flushed( out_file.tmp_name() );
+      if ( !flushed.declared( AnnotationType::LEMMA, "late-set" ) ){
+	cerr << " auto-flush lost a declaration of the first node" << endl;
+	return false;
+      }
+    }
+    // after the first output a new declaration must fail
+    Engine late( input, out_file.tmp_name() );
+    late.set_auto_flush( Engine::FlushPolicy::TOP_NODES );
+    auto second = lemmatize( "eng.p.4.s.1" );
+    try {
+      while ( FoliaElement *s = late.get_node( "s" ) ){
+	second( s );
+      }
+      cerr << " auto-flush accepted a declaration after the header" << endl;
+      return false;
+    }
+    catch ( const DeclarationError& ){
+    }
+    return true;
+  }
+
+  bool engine_prologue_sanity_check(){
+    Document d( "xml:id='eng'" );
+    engine_document( d );
+    stringstream doc_ss;
+    d.save( doc_ss );
+    const string input = doc_ss.str();
+    stringstream head_ss;
+    const string epilogue = d.save_prologue( head_ss );
+    const string prologue = head_ss.str();
+    if ( !TiCC::match_back( prologue, "<text xml:id=\"eng.text\">" )
+	 || prologue.find( "eng.p.1" ) != string::npos
+	 || epilogue != "  </text>\n</FoLiA>\n"
+	 || input.find( prologue ) != 0 ){
+      cerr << " save_prologue() is wrong: " << prologue << "..." << epilogue
+	   << endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool engine_matcher_sanity_check(){
+    const string input = engine_input();
+    ElementMatcher one_sentence;
+    one_sentence.add( ElementType::Sentence_t ).with_attribute( "xml:id",
+								 "eng.p.2.s.3" );
+    Engine scan( input );
+    vector<string> found;
+    while ( FoliaElement *s = scan.get_node( one_sentence ) ){
+      found.push_back( s->id() );
+    }
+    if ( found != vector<string>{ "eng.p.2.s.3" } ){
+      cerr << " ElementMatcher found: " << found << endl;
+      return false;
+    }
+    try {
+      ElementMatcher bad( "s|sentense" );
+      cerr << " ElementMatcher accepts unknown tags" << endl;
+      return false;
+    }
+    catch ( const ValueError& ){
+    }
+    return true;
+  }
+
+  bool engine_skip_scan_sanity_check(){
+    const string input = engine_input();
+    Engine skipper( input );
+    ElementTypeSet keep;
+    keep.insert( ElementType::Paragraph_t );
+    skipper.set_skip_scan( true, keep );
+    size_t words = 0;
+    while ( FoliaElement *w = skipper.get_node( "w" ) ){
+      ++words;
+      vector<FoliaElement*> up = skipper.ancestors();
+      if ( up.size() != 1
+	   || up[0]->element_id() != ElementType::Paragraph_t
+	   || w->id().find( up[0]->id() + "." ) != 0 ){
+	cerr << " skip scan: wrong ancestors for " << w->id() << endl;
+	return false;
+      }
+    }
+    if ( words != 24
+	 || skipper.doc()->index( "eng.p.1.s.1" ) != 0 ){
+      cerr << " skip scan: found " << words << " words" << endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool engine_passthrough_sanity_check(){
+    const string input = engine_input();
+    TiCC::tmp_stream out_file( "folia-pass", false );
+    out_file.close();
+    ElementMatcher one_sentence;
+    one_sentence.add( ElementType::Sentence_t ).with_attribute( "xml:id",
+								 "eng.p.2.s.3" );
+    {
+      Engine passer( input, out_file.tmp_name() );
+      passer.declare( AnnotationType::POS, "engine-set" );
+      passer.set_passthrough();
+      while ( FoliaElement *s = passer.get_node( one_sentence ) ){
+	tag_words( s );
+      }
+      passer.finish();
+    }
+    const string passed = file_contents( out_file.tmp_name() );
+    size_t body = input.find( "<text xml:id=\"eng.text\">" );
+    size_t match = input.find( "<s xml:id=\"eng.p.2.s.3\">" );
+    size_t tail = input.find( "</s>", match ) + 4;
+    const string before = input.substr( body, match - body );
+    const string after = input.substr( tail );
+    if ( passed.find( before ) == string::npos
+	 || !TiCC::match_back( passed, after )
+	 || passed.find( "<pos class=\"word3\"/>" ) == string::npos ){
+      cerr << " passthrough output is wrong: " << passed << endl;
+      return false;
+    }
+    Document passed_doc( out_file.tmp_name() );
+    if ( passed_doc.doc()->select<PosAnnotation>().size() != 2 ){
+      cerr << " passthrough output lost the tags: " << passed << endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool engine_checkpoint_sanity_check(){
+    const string input = engine_input();
+    TiCC::tmp_stream seq_file( "folia-seq", false );
+    seq_file.close();
+    TiCC::tmp_stream out_file( "folia-resumed", false );
+    out_file.close();
+    const string sequential = engine_output( input, seq_file.tmp_name(), 0 );
+    TiCC::tmp_stream ck_file( "folia-ck", false );
+    ck_file.close();
+    {
+      // simulate a crash halfway the third paragraph
+      Engine crashing( input, out_file.tmp_name() );
+      crashing.declare( AnnotationType::POS, "engine-set" );
+      crashing.set_checkpoint( ck_file.tmp_name() );
+      for ( int i=0; i < 8; ++i ){
+	tag_words( crashing.get_node( "s" ) );
+      }
+    }
+    Engine resumed;
+    if ( !resumed.resume( input, out_file.tmp_name(), ck_file.tmp_name() ) ){
+      cerr << " Engine::resume() found no checkpoint" << endl;
+      return false;
+    }
+    while ( FoliaElement *s = resumed.get_node( "s" ) ){
+      tag_words( s );
+    }
+    resumed.finish();
+    const string result = file_contents( out_file.tmp_name() );
+    if ( result != sequential ){
+      cerr << " the resumed output differs: " << result << endl;
+      return false;
+    }
+    Engine finished;
+    if ( finished.resume( input, out_file.tmp_name(), ck_file.tmp_name() ) ){
+      cerr << " the checkpoint survived a finished run" << endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool engine_stream_sanity_check(){
+    const string input = engine_input();
+    TiCC::tmp_stream seq_file( "folia-seq", false );
+    seq_file.close();
+    TiCC::tmp_stream out_file( "folia-stream", false );
+    out_file.close();
+    const string sequential = engine_output( input, seq_file.tmp_name(), 0 );
+    {
+      // deliver the input in small pieces, to cross many block boundaries
+      size_t pos = 0;
+      Engine streamed;
+      streamed.init_doc( [&]( char *buffer, int len ){
+			   int n = std::min<size_t>( std::min( len, 7 ),
+						     input.size() - pos );
+			   input.copy( buffer, n, pos );
+			   pos += n;
+			   return n;
+			 },
+			 out_file.tmp_name() );
+      streamed.declare( AnnotationType::POS, "engine-set" );
+      while ( FoliaElement *s = streamed.get_node( "s" ) ){
+	tag_words( s );
+      }
+      streamed.finish();
+    }
+    const string result = file_contents( out_file.tmp_name() );
+    if ( result != sequential ){
+      cerr << " the output of a streamed input differs: " << result << endl;
+      return false;
+    }
+    istringstream text_input( input );
+    TextEngine text_stream;
+    text_stream.init_doc( text_input );
+    text_stream.setup();
+    if ( text_stream.text_parent_count() != 24 ){
+      cerr << " a TextEngine on a stream found "
+	   << text_stream.text_parent_count() << " text parents" << endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool engine_scope_sanity_check(){
+    TiCC::tmp_stream out_file( "folia-scope", false );
+    out_file.close();
+    Document spans( "xml:id='scope'" );
+    spans.declare( AnnotationType::ENTITY, "ents" );
+    FoliaElement *span_txt = spans.addText( getArgs( "xml:id='scope.text'" ) );
+    Word *first = 0;
+    Sentence *last = 0;
+    for ( int i=1; i <= 3; ++i ){
+      string pid = "scope.p." + TiCC::toString(i);
+      FoliaElement *p = new Paragraph( getArgs( "xml:id='" + pid + "'" ),
+				       &spans );
+      span_txt->append( p );
+      last = new Sentence( getArgs( "xml:id='" + pid + ".s.1'" ), &spans );
+      p->append( last );
+      Word *w = last->addWord( "text='Lui'" );
+      last->addWord( "text='lekker'" );
+      FoliaElement *layer = new EntitiesLayer( getArgs( "set='ents'" ),
+					       &spans );
+      last->append( layer );
+      FoliaElement *ent = new Entity( getArgs( "class='loc'" ), &spans );
+      layer->append( ent );
+      ent->append( w );
+      if ( !first ){
+	first = w;
+      }
+    }
+    stringstream span_ss;
+    spans.save( span_ss );
+    const string span_input = span_ss.str();
+    {
+      Engine scoped( span_input, out_file.tmp_name() );
+      scoped.set_auto_flush( Engine::FlushPolicy::TOP_NODES );
+      scoped.set_scoped_references();
+      while ( FoliaElement *w = scoped.get_node( "w" ) ){
+	if ( w->id() == "scope.p.3.s.1.w.1"
+	     && scoped.doc()->index( first->id() ) != 0 ){
+	  cerr << " scoped references keep flushed ids" << endl;
+	  return false;
+	}
+      }
+      scoped.finish();
+    }
+    Document scoped_out( out_file.tmp_name() );
+    if ( scoped_out.xmlstring() != spans.xmlstring() ){
+      cerr << " scoped references change the output: " << scoped_out << endl;
+      return false;
+    }
+    // now refer to a word in another sentence
+    FoliaElement *stray = new Entity( getArgs( "class='per'" ), &spans );
+    last->annotation<EntitiesLayer>()->append( stray );
+    stray->append( first );
+    stringstream stray_ss;
+    spans.save( stray_ss );
+    const string stray_input = stray_ss.str();
+    Engine out_of_scope( stray_input );
+    out_of_scope.set_scoped_references();
+    try {
+      while ( out_of_scope.get_node( "s" ) ){
+      }
+      cerr << " a reference outside its sentence was accepted" << endl;
+      return false;
+    }
+    catch ( const XmlError& ){
+    }
+    return true;
+  }
+
+  bool index_sanity_check(){
+    Document d( "xml:id='idx'" );
+    d.declare( AnnotationType::POS, "idx-set" );
+    FoliaElement *txt = d.addText( getArgs( "xml:id='idx.text'" ) );
+    FoliaElement *div = new Division( getArgs( "" ), &d );
+    txt->append( div );
+    for ( int i=1; i <= 3; ++i ){
+      string sid = "idx.s." + TiCC::toString(i);
+      Sentence *s = new Sentence( getArgs( "xml:id='" + sid + "'" ), &d );
+      div->append( s );
+      FoliaElement *w = s->addWord( "text='word" + TiCC::toString(i) + "'" );
+      w->addPosAnnotation( getArgs( "class='N'" ) );
+      s->addWord( "text='.'" );
+    }
+    TiCC::tmp_stream doc_file( "folia-idx", false );
+    d.save( doc_file.os() );
+    doc_file.close();
+    TiCC::tmp_stream idx_file( "folia-idx", false );
+    idx_file.close();
+    DocumentIndex built;
+    built.build( doc_file.tmp_name() );
+    built.save( idx_file.tmp_name() );
+    DocumentIndex index;
+    index.load( doc_file.tmp_name(), idx_file.tmp_name() );
+    if ( index.size() != 10 || !index.has( "idx.s.2.w.1" ) ){
+      cerr << " DocumentIndex holds " << index.size() << " ids" << endl;
+      return false;
+    }
+    Document *part = index.extract( "idx.s.2.w.1" );
+    if ( !part
+	 || !(*part)["idx.s.2.w.1"]
+	 || (*part)["idx.s.2.w.1"]->xmlstring() != d["idx.s.2.w.1"]->xmlstring()
+	 || (*part)["idx.s.1"]
+	 || !part->declared( AnnotationType::POS, "idx-set" ) ){
+      cerr << " DocumentIndex::extract() is wrong: " << part << endl;
+      delete part;
+      return false;
+    }
+    delete part;
+    if ( index.extract( "idx.s.4" ) != 0 ){
+      cerr << " DocumentIndex::extract() found an unknown id" << endl;
+      return false;
+    }
+    ofstream os( doc_file.tmp_name(), ios::app );
+    os << "<!-- changed -->" << endl;
+    os.close();
+    try {
+      index.load( doc_file.tmp_name(), idx_file.tmp_name() );
+      cerr << " DocumentIndex::load() accepts a changed file" << endl;
+      return false;
+    }
+    catch ( const IndexError& ){
+    }
+    return true;
+  }
+
 } //namespace folia
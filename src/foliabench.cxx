@@ -0,0 +1,250 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of libfolia
+
+  libfolia is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  libfolia is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "ticcutils/CommandLine.h"
+#include "libfolia/folia.h"
+
+using namespace std;
+using namespace folia;
+
+// microbenchmarks for some hot spots in libfolia.
+// Not installed, just for developers.
+
+void usage(){
+  cerr << "usage: foliabench [options] <foliafile>" << endl;
+  cerr << "   or: foliabench [options] --startup" << endl;
+  cerr << "options are" << endl;
+  cerr << "\t-h, --help\t\t This help" << endl;
+  cerr << "\t-n value\t\t number of rounds to run (default 10)" << endl;
+  cerr << "\t--startup\t\t time the start of a program linked with libfolia" << endl;
+}
+
+double seconds_since( const chrono::steady_clock::time_point& start ){
+  chrono::duration<double> d = chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+void collect( const FoliaElement *el, vector<const FoliaElement*>& nodes ){
+  nodes.push_back( el );
+  for ( const auto *c : el->data() ){
+    collect( c, nodes );
+  }
+}
+
+int startup_bench( const char *self, int rounds ){
+  // start ourself 'rounds' times with --noop, which returns from main()
+  // right away. So we time the loading and static initialization of
+  // libfolia.
+  auto start = chrono::steady_clock::now();
+  for ( int i=0; i < rounds; ++i ){
+    pid_t pid = fork();
+    if ( pid < 0 ){
+      cerr << "fork failed" << endl;
+      return EXIT_FAILURE;
+    }
+    if ( pid == 0 ){
+      execl( self, self, "--noop", static_cast<char*>(0) );
+      _exit( 127 );
+    }
+    int status = 0;
+    waitpid( pid, &status, 0 );
+    if ( !WIFEXITED(status) || WEXITSTATUS(status) != 0 ){
+      cerr << "running " << self << " --noop failed" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+  cout << "startup:\t" << 1e3 * seconds_since( start ) / rounds
+       << " ms/run" << endl;
+  start = chrono::steady_clock::now();
+  string host = get_host_name();
+  cout << "first host name:\t" << 1e3 * seconds_since( start ) << " ms ("
+       << host << ")" << endl;
+  start = chrono::steady_clock::now();
+  host = get_host_name();
+  cout << "cached host name:\t" << 1e3 * seconds_since( start ) << " ms"
+       << endl;
+  return EXIT_SUCCESS;
+}
+
+template <typename T>
+size_t count_cast( const vector<const FoliaElement*>& nodes ){
+  size_t hits = 0;
+  for ( const auto *el : nodes ){
+    if ( dynamic_cast<const T*>( el ) ){
+      ++hits;
+    }
+  }
+  return hits;
+}
+
+template <typename T>
+size_t count_table( const vector<const FoliaElement*>& nodes ){
+  size_t hits = 0;
+  for ( const auto *el : nodes ){
+    if ( el->isSubClass<T>() ){
+      ++hits;
+    }
+  }
+  return hits;
+}
+
+size_t subclass_by_cast( const vector<const FoliaElement*>& nodes ){
+  // the checks text() and parseXml() do, the old way
+  return count_cast<AbstractTextMarkup>( nodes )
+    + count_cast<String>( nodes )
+    + count_cast<Word>( nodes )
+    + count_cast<TextContent>( nodes )
+    + count_cast<Morpheme>( nodes )
+    + count_cast<Phoneme>( nodes )
+    + count_cast<AbstractCorrectionChild>( nodes )
+    + count_cast<AbstractSpanAnnotation>( nodes );
+}
+
+size_t subclass_by_table( const vector<const FoliaElement*>& nodes ){
+  // the same checks using isSubClass<T>()
+  return count_table<AbstractTextMarkup>( nodes )
+    + count_table<String>( nodes )
+    + count_table<Word>( nodes )
+    + count_table<TextContent>( nodes )
+    + count_table<Morpheme>( nodes )
+    + count_table<Phoneme>( nodes )
+    + count_table<AbstractCorrectionChild>( nodes )
+    + count_table<AbstractSpanAnnotation>( nodes );
+}
+
+int main( int argc, const char* argv[] ){
+  int rounds = 10;
+  string file_name;
+  try {
+    TiCC::CL_Options Opts( "hn:", "help,startup,noop" );
+    Opts.init(argc, argv );
+    if ( Opts.extract( "noop" ) ){
+      return EXIT_SUCCESS;
+    }
+    if ( Opts.extract( 'h' )
+	 || Opts.extract( "help" ) ){
+      usage();
+      return EXIT_SUCCESS;
+    }
+    string value;
+    if ( Opts.extract( 'n', value ) ){
+      rounds = TiCC::stringTo<int>( value );
+    }
+    if ( Opts.extract( "startup" ) ){
+      return startup_bench( argv[0], rounds );
+    }
+    vector<string> files = Opts.getMassOpts();
+    if ( files.size() != 1 ){
+      usage();
+      return EXIT_FAILURE;
+    }
+    file_name = files[0];
+  }
+  catch( exception& e ){
+    cerr << "FAIL: " << e.what() << endl;
+    usage();
+    return EXIT_FAILURE;
+  }
+  try {
+    auto start = chrono::steady_clock::now();
+    Document doc( "file='" + file_name + "'" );
+    cout << "load:\t\t" << seconds_since( start ) << " s" << endl;
+    vector<const FoliaElement*> nodes;
+    collect( doc.doc(), nodes );
+    cout << "nodes:\t\t" << nodes.size() << endl;
+
+    size_t cast_hits = 0;
+    start = chrono::steady_clock::now();
+    for ( int i=0; i < rounds; ++i ){
+      cast_hits += subclass_by_cast( nodes );
+    }
+    double cast_time = seconds_since( start );
+    size_t table_hits = 0;
+    start = chrono::steady_clock::now();
+    for ( int i=0; i < rounds; ++i ){
+      table_hits += subclass_by_table( nodes );
+    }
+    double table_time = seconds_since( start );
+    if ( cast_hits != table_hits ){
+      cerr << "isSubClass<T>() and dynamic_cast disagree: "
+	   << table_hits << " versus " << cast_hits << endl;
+      return EXIT_FAILURE;
+    }
+    double checks = 8.0 * nodes.size() * rounds;
+    cout << "dynamic_cast:\t" << 1e9 * cast_time / checks << " ns/check" << endl;
+    cout << "isSubClass:\t" << 1e9 * table_time / checks << " ns/check" << endl;
+
+    vector<string> tags;
+    for ( const auto *el : nodes ){
+      tags.push_back( el->xmltag() );
+    }
+    size_t map_hits = 0;
+    start = chrono::steady_clock::now();
+    for ( int i=0; i < rounds; ++i ){
+      for ( const auto& tag : tags ){
+	// what stringToElementType() used to do
+	map_hits += ( s_et_map.find( string( tag.c_str() ) ) != s_et_map.end() );
+      }
+    }
+    double map_time = seconds_since( start );
+    size_t hash_hits = 0;
+    start = chrono::steady_clock::now();
+    for ( int i=0; i < rounds; ++i ){
+      for ( const auto& tag : tags ){
+	ElementType et;
+	hash_hits += lookupElementType( tag, et );
+      }
+    }
+    double hash_time = seconds_since( start );
+    double lookups = double( tags.size() ) * rounds;
+    cout << "tag map:\t" << 1e9 * map_time / lookups << " ns/lookup ("
+	 << map_hits / rounds << " hits)" << endl;
+    cout << "tag hash:\t" << 1e9 * hash_time / lookups << " ns/lookup ("
+	 << hash_hits / rounds << " hits)" << endl;
+
+    // one untimed call, to exclude building the lazy tables
+    size_t len = doc.text().length();
+    start = chrono::steady_clock::now();
+    len = 0;
+    for ( int i=0; i < rounds; ++i ){
+      len += doc.text().length();
+    }
+    cout << "text():\t\t" << 1e3 * seconds_since( start ) / rounds
+	 << " ms/call (" << len / rounds << " characters)" << endl;
+  }
+  catch( exception& e ){
+    cerr << file_name << ": " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
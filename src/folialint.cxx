@@ -27,8 +27,16 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <sys/resource.h>
 #include "ticcutils/CommandLine.h"
 #include "libfolia/folia.h"
 
@@ -56,6 +64,269 @@ void usage(){
   cerr << "\t-c --canonical\t\t output in a predefined order. Makes comparisons easier" << endl;
   cerr << "\t-d value, --debug=value\t Run more verbose." << endl;
   cerr << "\t--permissive\t\t Accept some unwise constructions." << endl;
+  cerr << "\t-j N, --threads=N\t check N files in parallel. (default 1)" << endl;
+  cerr << "\t\t\t\t N=0 means: use all available cores." << endl;
+  cerr << "\t--unordered\t\t with -j: report the results as soon as a file" << endl;
+  cerr << "\t\t\t\t is done, instead of in the order of the input." << endl;
+  cerr << "\t--summary\t\t add a summary with the timing per file." << endl;
+  cerr << "\t--stats\t\t\t report the time spent per phase, the peak memory" << endl;
+  cerr << "\t\t\t\t use and the number of elements per type." << endl;
+}
+
+struct lint_settings {
+  /// the settings that are the same for every inputfile
+  string mode;
+  string command;
+  string outputName;
+  bool nooutput;
+  bool kanon;
+  bool strip;
+  bool warn;
+  bool stats;
+};
+
+struct lint_result {
+  /// the outcome of checking one inputfile
+  string out;        ///< the buffered output (in parallel mode only)
+  string err;        ///< the buffered messages (in parallel mode only)
+  bool ok = false;   ///< did the file validate?
+  double seconds = 0; ///< the time spent on the file
+  bool done = false; ///< is the result ready to report?
+};
+
+void count_elements( const folia::FoliaElement *e,
+		     map<folia::ElementType,size_t>& counts ){
+  /// count the elements in the tree below e, per ElementType
+  ++counts[e->element_id()];
+  for ( const auto& child : e->data() ){
+    count_elements( child, counts );
+  }
+}
+
+void report_stats( const folia::Document& d,
+		   double seconds,
+		   ostream& err ){
+  /// output the timing per phase, the memory use and the element counts
+  /*!
+    \param d the document, with metrics enabled
+    \param seconds the total time spent on the file
+    \param err the output stream
+  */
+  const folia::Metrics *m = d.metrics();
+  err << "statistics for " << d.filename() << ":" << endl;
+  err << "\tphase\t\t\twall(s)\tcpu(s)\tcalls" << endl;
+  double measured = 0;
+  for ( unsigned int i=0; i < folia::PHASE_COUNT; ++i ){
+    folia::Phase p = static_cast<folia::Phase>(i);
+    string name = folia::toString( p );
+    err << "\t" << name << string( name.size() < 16 ? 2 : 1, '\t' )
+	<< m->wall(p) << "\t" << m->cpu(p) << "\t" << m->calls(p) << endl;
+    measured += m->wall(p);
+  }
+  err << "\tother\t\t\t" << std::max( 0.0, seconds - measured ) << endl;
+  err << "\ttotal\t\t\t" << seconds << endl;
+  err << "counters:" << endl;
+  for ( unsigned int i=0; i < folia::COUNTER_COUNT; ++i ){
+    folia::Counter c = static_cast<folia::Counter>(i);
+    err << "\t" << folia::toString( c ) << "\t" << m->counter(c) << endl;
+  }
+  struct rusage usage;
+  if ( getrusage( RUSAGE_SELF, &usage ) == 0 ){
+    // on Linux, ru_maxrss is in kilobytes
+    err << "peak RSS: " << usage.ru_maxrss << " kB (for the whole process)"
+	<< endl;
+  }
+  map<folia::ElementType,size_t> counts;
+  if ( d.doc() ){
+    count_elements( d.doc(), counts );
+  }
+  vector<pair<size_t,string>> sorted;
+  size_t total = 0;
+  for ( const auto& [et,cnt] : counts ){
+    sorted.push_back( make_pair( cnt, folia::toString( et ) ) );
+    total += cnt;
+  }
+  sort( sorted.begin(), sorted.end(),
+	[]( const pair<size_t,string>& a, const pair<size_t,string>& b ){
+	  return a.first > b.first
+	    || ( a.first == b.first && a.second < b.second );
+	} );
+  err << "elements: " << total << endl;
+  for ( const auto& [cnt,name] : sorted ){
+    err << "\t" << name << "\t" << cnt << endl;
+  }
+}
+
+bool check_file( const string& inputName,
+		 const lint_settings& settings,
+		 ostream& out,
+		 ostream& err ){
+  /// check one FoLiA file, and output it when requested
+  /*!
+    \param inputName the file to check
+    \param settings the global settings
+    \param out the stream to output the FoLiA to
+    \param err the stream for errors and warnings
+    \return true when the file is valid
+
+    This function may run on several threads at once, so it only writes to
+    the given streams.
+  */
+  try {
+    auto start = chrono::steady_clock::now();
+    string cmd = "file='" + inputName + "'";
+    cmd += settings.mode;
+    if ( settings.stats ){
+      cmd += ", metrics='yes'";
+    }
+    folia::Document d( cmd );
+    if ( !d.version_below(2,0)
+	 && !(settings.kanon||settings.strip)
+	 && d.get_processors_by_name( "folialint" ).empty() ){
+      folia::KWargs args;
+      args.add("name","folialint");
+      args.add("id","folialint");
+      args.add("generator","yes");
+      args.add("begindatetime","now()");
+      args.add("command",settings.command);
+      folia::processor *proc = d.add_processor( args );
+      proc->get_system_defaults();
+      proc->set_metadata( "valid", "yes" );
+    }
+    if ( !settings.outputName.empty() ){
+      d.save( settings.outputName, settings.kanon );
+    }
+    else if ( !settings.nooutput ){
+      d.set_canonical(settings.kanon);
+      out << d;
+    }
+    else {
+      err << "Validated successfully: " << inputName << endl;
+    }
+    if ( settings.warn ){
+      if ( d.compare_to_build_version() ){
+	err << "WARNING: the document had version: " << d.version()
+	    << " and the library is at version: "
+	    <<  folia::folia_version() << endl;
+      }
+      multimap<folia::AnnotationType, string> und = d.unused_declarations();
+      if ( !und.empty() ){
+	err << "the following annotationsets are declared but unused: " << endl;
+	for ( const auto& [ann,sett] : und ){
+	  err << folia::toString( ann )<< "-annotation, set=" << sett << endl;
+	}
+      }
+    }
+    if ( settings.stats ){
+      chrono::duration<double> took = chrono::steady_clock::now() - start;
+      report_stats( d, took.count(), err );
+    }
+  }
+  catch( const exception& e ){
+    err << e.what() << endl;
+    return false;
+  }
+  return true;
+}
+
+void report( const lint_result& result ){
+  /// output the buffered output and messages of a file
+  cout << result.out << flush;
+  cerr << result.err << flush;
+}
+
+void check_parallel( const vector<string>& fileNames,
+		     const lint_settings& settings,
+		     unsigned int threads,
+		     bool unordered,
+		     vector<lint_result>& results ){
+  /// check the files using a number of worker threads
+  /*!
+    \param fileNames the files to check
+    \param settings the global settings
+    \param threads the number of workers
+    \param unordered when true, report every file as soon as it is done.
+    Otherwise the reports follow the order of \e fileNames
+    \param results the outcome per file. The buffers are cleared once
+    reported
+
+    Every worker repeatedly takes the next unchecked file. All output and
+    messages are buffered per file, so reports never interleave.
+  */
+  results.resize( fileNames.size() );
+  atomic<size_t> next_file(0);
+  mutex report_mutex;
+  size_t next_report = 0;
+  auto worker = [&](){
+    while ( true ){
+      size_t i = next_file++;
+      if ( i >= fileNames.size() ){
+	break;
+      }
+      ostringstream out;
+      ostringstream err;
+      auto start = chrono::steady_clock::now();
+      bool ok = check_file( fileNames[i], settings, out, err );
+      chrono::duration<double> took = chrono::steady_clock::now() - start;
+      lock_guard<mutex> lock( report_mutex );
+      lint_result& result = results[i];
+      result.out = out.str();
+      result.err = err.str();
+      result.ok = ok;
+      result.seconds = took.count();
+      result.done = true;
+      if ( unordered ){
+	report( result );
+	result.out.clear();
+	result.err.clear();
+      }
+      else {
+	while ( next_report < results.size()
+		&& results[next_report].done ){
+	  report( results[next_report] );
+	  results[next_report].out.clear();
+	  results[next_report].err.clear();
+	  ++next_report;
+	}
+      }
+    }
+  };
+  vector<thread> workers;
+  for ( unsigned int t=0; t < threads; ++t ){
+    workers.push_back( thread( worker ) );
+  }
+  for ( auto& w : workers ){
+    w.join();
+  }
+}
+
+void summarize( const vector<string>& fileNames,
+		const vector<lint_result>& results,
+		double wall ){
+  /// output the timing per file and some totals on stderr
+  double total = 0;
+  size_t failed = 0;
+  size_t slowest = 0;
+  cerr << "summary:" << endl;
+  for ( size_t i=0; i < results.size(); ++i ){
+    cerr << "\t" << fileNames[i] << "\t"
+	 << (results[i].ok?"valid":"FAILED") << "\t"
+	 << results[i].seconds << "s" << endl;
+    total += results[i].seconds;
+    if ( !results[i].ok ){
+      ++failed;
+    }
+    if ( results[i].seconds > results[slowest].seconds ){
+      slowest = i;
+    }
+  }
+  cerr << "checked " << results.size() << " file(s), " << failed
+       << " failed, in " << wall << "s (" << total << "s summed over files)"
+       << endl;
+  if ( !results.empty() ){
+    cerr << "slowest: " << fileNames[slowest] << " ("
+	 << results[slowest].seconds << "s)" << endl;
+  }
 }
 
 int main( int argc, const char* argv[] ){
@@ -69,14 +340,18 @@ int main( int argc, const char* argv[] ){
   bool kanon = false;
   bool autodeclare = false;
   bool do_explicit = false;
+  bool unordered = false;
+  bool summary = false;
+  bool stats = false;
+  unsigned int threads = 1;
   string debug;
   vector<string> fileNames;
   string command;
   try {
-    TiCC::CL_Options Opts( "hVd:acxo:",
+    TiCC::CL_Options Opts( "hVd:acxo:j:",
 			   "nochecktext,debug:,permissive,strip,output:,"
 			   "nooutput,help,fixtext,warn,version,canonical,"
-			   "explicit,autodeclare");
+			   "explicit,autodeclare,threads:,unordered,summary,stats");
     Opts.init(argc, argv );
     if ( Opts.extract( 'h' )
 	 || Opts.extract( "help" ) ){
@@ -113,6 +388,19 @@ int main( int argc, const char* argv[] ){
     Opts.extract( "debug", debug ) || Opts.extract( 'd', debug );
     Opts.extract( "output", outputName ) || Opts.extract( 'o', outputName );
     autodeclare = Opts.extract( "autodeclare" ) || Opts.extract( 'a' );
+    string value;
+    if ( Opts.extract( "threads", value ) || Opts.extract( 'j', value ) ){
+      if ( !TiCC::stringTo( value, threads ) ){
+	cerr << "illegal value for -j/--threads: " << value << endl;
+	return EXIT_FAILURE;
+      }
+      if ( threads == 0 ){
+	threads = std::max( 1u, thread::hardware_concurrency() );
+      }
+    }
+    unordered = Opts.extract( "unordered" );
+    summary = Opts.extract( "summary" );
+    stats = Opts.extract( "stats" );
 
     if ( !Opts.empty() ){
       cerr << "unsupported option(s): " << Opts.toString() << endl;
@@ -171,55 +459,40 @@ int main( int argc, const char* argv[] ){
   if ( !debug.empty() ){
     mode += ", debug='" + debug + "'";
   }
-  for ( const auto& inputName : fileNames ){
-    try {
-      string cmd = "file='" + inputName + "'";
-      cmd += mode;
-      //      cerr << "running " << cmd << endl;
-      folia::Document d( cmd );
-      if ( !d.version_below(2,0)
-	   && !(kanon||strip)
-	   && d.get_processors_by_name( "folialint" ).empty() ){
-	folia::KWargs args;
-	args.add("name","folialint");
-	args.add("id","folialint");
-	args.add("generator","yes");
-	args.add("begindatetime","now()");
-	args.add("command",command);
-	folia::processor *proc = d.add_processor( args );
-	proc->get_system_defaults();
-	proc->set_metadata( "valid", "yes" );
-      }
-      if ( !outputName.empty() ){
-	d.save( outputName, kanon );
-      }
-      else if ( !nooutput ){
-	d.set_canonical(kanon);
-	cout << d;
-      }
-      else {
-	cerr << "Validated successfully: " << inputName << endl;
-      }
-      if ( warn ){
-	if ( d.compare_to_build_version() ){
-	  cerr << "WARNING: the document had version: " << d.version()
-	       << " and the library is at version: "
-	       <<  folia::folia_version() << endl;
-	}
-	multimap<folia::AnnotationType, string> und = d.unused_declarations();
-	if ( !und.empty() ){
-	  cerr << "the following annotationsets are declared but unused: " << endl;
-	  for ( const auto& [ann,sett] : und ){
-	    cerr << folia::toString( ann )<< "-annotation, set=" << sett << endl;
-	  }
-	}
-      }
+  lint_settings settings;
+  settings.mode = mode;
+  settings.command = command;
+  settings.outputName = outputName;
+  settings.nooutput = nooutput;
+  settings.kanon = kanon;
+  settings.strip = strip;
+  settings.warn = warn;
+  settings.stats = stats;
+  threads = std::min<size_t>( threads, fileNames.size() );
+  vector<lint_result> results;
+  auto start = chrono::steady_clock::now();
+  if ( threads > 1 ){
+    check_parallel( fileNames, settings, threads, unordered, results );
+  }
+  else {
+    results.resize( fileNames.size() );
+    for ( size_t i=0; i < fileNames.size(); ++i ){
+      auto file_start = chrono::steady_clock::now();
+      results[i].ok = check_file( fileNames[i], settings, cout, cerr );
+      chrono::duration<double> took
+	= chrono::steady_clock::now() - file_start;
+      results[i].seconds = took.count();
     }
-    catch( const exception& e ){
-      cerr << e.what() << endl;
+  }
+  chrono::duration<double> wall = chrono::steady_clock::now() - start;
+  for ( const auto& result : results ){
+    if ( !result.ok ){
       ++fail_count;
     }
   }
+  if ( summary ){
+    summarize( fileNames, results, wall.count() );
+  }
   if ( fail_count > 0 ){
     exit( EXIT_FAILURE );
   }
@@ -71,5 +71,61 @@ int main() {
   if ( !subclass_sanity_check() ){
     return EXIT_FAILURE;
   }
+  cout << "Binary snapshot sanity" << endl;
+  if ( !binary_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Lazy parsing sanity" << endl;
+  if ( !lazy_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Parallel parsing sanity" << endl;
+  if ( !parallel_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Concurrent reading sanity" << endl;
+  if ( !concurrency_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Engine pipeline sanity" << endl;
+  if ( !engine_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Engine auto-flush sanity" << endl;
+  if ( !engine_flush_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Engine prologue sanity" << endl;
+  if ( !engine_prologue_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Engine matcher sanity" << endl;
+  if ( !engine_matcher_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Engine skip scan sanity" << endl;
+  if ( !engine_skip_scan_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Engine passthrough sanity" << endl;
+  if ( !engine_passthrough_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Engine checkpoint sanity" << endl;
+  if ( !engine_checkpoint_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Engine stream input sanity" << endl;
+  if ( !engine_stream_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Engine scoped references sanity" << endl;
+  if ( !engine_scope_sanity_check() ){
+    return EXIT_FAILURE;
+  }
+  cout << "Document index sanity" << endl;
+  if ( !index_sanity_check() ){
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }